@@ -2,7 +2,13 @@
 
 echo "Building liquid library"
 (set -x; clang -g -Isrc/liquid -Ideps/include -fPIC -shared -lGLFW -lGLEW -framework OpenGL -o lib/libliquid.dylib src/liquid/unity_build.c)
+# Headless Linux build (EGL, no window system needed at runtime)
+#(set -x; cc -g -DGRAPHICS_HEADLESS -Isrc/liquid -Ideps/include -fPIC -shared -o lib/libliquid.so src/liquid/unity_build.c -lglfw -lGLEW -lGL -lEGL -lpthread -lm)
 #echo "Building asset_compile"
 #(set -x; clang -g -Isrc/liquid -Llib -lliquid -o obj/asset_compile src/asset_compile/asset_compile.c)
 echo "Building sandbox"
-(set -x; clang -g -Isrc/liquid -Llib -lliquid -o obj/sandbox src/sandbox/main.c)
\ No newline at end of file
+(set -x; clang -g -Isrc/liquid -Llib -lliquid -o obj/sandbox src/sandbox/main.c src/sandbox/stress_scene.c)
+echo "Building liquid_bench"
+(set -x; clang -g -O2 -Isrc/liquid -Llib -lliquid -lGLFW -lGLEW -framework OpenGL -o obj/liquid_bench src/bench/main.c)
+echo "Building liquid_replay"
+(set -x; clang -g -O2 -Isrc/liquid -Llib -lliquid -lGLFW -lGLEW -framework OpenGL -o obj/liquid_replay src/replay/main.c)
\ No newline at end of file
@@ -0,0 +1,377 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "maths.h"
+#include "graphics.h"
+#include "texture.h"
+#include "obj_loading.h"
+#include "cpu_profiler.h"
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#define BENCH_MAX_RESULTS 64
+#define BENCH_MAX_SAMPLES 4096
+#define BENCH_NAME_LENGTH 64
+
+#define BENCH_DRAWS_PER_FRAME 1000
+#define BENCH_TRANSFORMS_PER_ITERATION 100000
+
+typedef void (*BenchFunc)(void *user_data);
+
+typedef struct
+{
+	char name[BENCH_NAME_LENGTH];
+	u32 iterations;
+	f64 median_ms;
+	f64 p99_ms;
+	f64 throughput;
+	const char *throughput_unit;
+
+	bool has_baseline;
+	f64 baseline_ms;
+	bool regressed;
+} BenchResult;
+
+typedef struct
+{
+	u32 warmup;
+	u32 iterations;
+	f64 threshold;
+
+	BenchResult results[BENCH_MAX_RESULTS];
+	u32 num_results;
+} Bench;
+
+static f64 samples[BENCH_MAX_SAMPLES];
+
+static int compare_f64(const void *a, const void *b)
+{
+	f64 x = *(const f64 *) a;
+	f64 y = *(const f64 *) b;
+	return (x > y) - (x < y);
+}
+
+// Runs func warmup times untimed, then iterations times timed. The median and
+// the 99th percentile (nearest rank) are kept; throughput is work done per
+// iteration divided by the median.
+static void bench_run(Bench *bench, const char *name, BenchFunc func, void *user_data, f64 work, const char *unit)
+{
+	if (bench->num_results == BENCH_MAX_RESULTS) {
+		WARN("Too many benchmarks, skipping %s.", name);
+		return;
+	}
+
+	for (u32 i = 0; i < bench->warmup; i++) {
+		func(user_data);
+	}
+
+	u32 n = bench->iterations;
+	for (u32 i = 0; i < n; i++) {
+		u64 begin = cpu_profiler_now();
+		func(user_data);
+		samples[i] = (f64) (cpu_profiler_now() - begin) / 1000000.0;
+	}
+	qsort(samples, n, sizeof(f64), compare_f64);
+
+	BenchResult *result = &bench->results[bench->num_results++];
+	memset(result, 0, sizeof(BenchResult));
+	snprintf(result->name, BENCH_NAME_LENGTH, "%s", name);
+	result->iterations = n;
+	result->median_ms = n % 2 ? samples[n / 2] : 0.5 * (samples[n / 2 - 1] + samples[n / 2]);
+	u32 rank = (u32) (0.99 * n + 0.999999);
+	result->p99_ms = samples[(rank > 0 ? rank : 1) - 1];
+	result->throughput = result->median_ms > 0.0 ? work / (result->median_ms / 1000.0) : 0.0;
+	result->throughput_unit = unit;
+
+	printf("%-24s median %10.4f ms   p99 %10.4f ms   %14.2f %s\n", name, result->median_ms, result->p99_ms, result->throughput, unit);
+}
+
+/* -- Benchmarks -- */
+
+static void bench_obj_load(void *user_data)
+{
+	Mesh mesh = obj_load_mesh((const char *) user_data);
+	mesh_destroy(&mesh);
+}
+
+static void bench_texture_load(void *user_data)
+{
+	Texture texture = texture_load((const char *) user_data);
+	texture_destroy(&texture);
+}
+
+typedef struct
+{
+	GraphicsData *graphics_data;
+	Window window;
+	enum DrawCommandType type;
+	Mesh mesh;
+	Texture texture;
+	Font font;
+	mat4 view_projection;
+	mat4 ortho;
+} DrawBench;
+
+// One full frame of BENCH_DRAWS_PER_FRAME commands, finished on the GPU so
+// that the time covers the whole draw and not just the submission
+static void bench_draws(void *user_data)
+{
+	DrawBench *draw = user_data;
+	GraphicsData *graphics_data = draw->graphics_data;
+
+	graphics_begin_frame(graphics_data, &draw->window);
+
+	for (u32 i = 0; i < BENCH_DRAWS_PER_FRAME; i++) {
+		f32 x = (f32) (i % 40);
+		f32 y = (f32) (i / 40);
+
+		DrawCommand cmd = {draw->type, 0, 0, NULL};
+		DrawMeshCommandData mesh_data;
+		DrawRectCommandData rect_data;
+		DrawTextCommandData text_data;
+		if (draw->type == DRAW_MESH) {
+			Transform transform = {vec3_new(-4.0f + 0.2f * x, -2.5f + 0.2f * y, -8.0f), vec3_new(0.1f, 0.1f, 0.1f), quat_null_rotation()};
+			DrawMeshCommandData data = {draw->mesh, transform, draw->view_projection, draw->texture, vec4_new(0.2f, 0.2f, 0.2f, 1.0f)};
+			mesh_data = data;
+			cmd.data = &mesh_data;
+		} else if (draw->type == DRAW_RECT) {
+			Transform transform = {vec3_new(16.0f + 32.0f * x, 16.0f + 28.0f * y, 0.0f), vec3_new(12.0f, 12.0f, 1.0f), quat_null_rotation()};
+			DrawRectCommandData data = {transform, draw->ortho, draw->texture, vec4_new(1.0f, 1.0f, 1.0f, 1.0f)};
+			rect_data = data;
+			cmd.data = &rect_data;
+		} else {
+			Transform transform = {vec3_new(32.0f * x, 28.0f + 28.0f * y, 0.0f), vec3_new(1.0f, 1.0f, 1.0f), quat_null_rotation()};
+			DrawTextCommandData data = {"Text", transform, draw->ortho, draw->font};
+			text_data = data;
+			cmd.data = &text_data;
+		}
+		graphics_submit_call(graphics_data, &cmd);
+	}
+
+	graphics_sort_and_flush_queue(graphics_data);
+	graphics_end_frame(graphics_data, &draw->window);
+	glFinish();
+}
+
+static Transform transforms[BENCH_TRANSFORMS_PER_ITERATION];
+static mat4 matrices[BENCH_TRANSFORMS_PER_ITERATION];
+
+static void bench_mat4_transformation(void *user_data)
+{
+	for (u32 i = 0; i < BENCH_TRANSFORMS_PER_ITERATION; i++) {
+		matrices[i] = mat4_transformation(&transforms[i]);
+	}
+}
+
+/* -- Results -- */
+
+static bool file_exists(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	if (f) {
+		fclose(f);
+	}
+	return f != NULL;
+}
+
+static f64 file_size_mb(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	fseek(f, 0, SEEK_END);
+	f64 result = (f64) ftell(f) / (1024.0 * 1024.0);
+	fclose(f);
+	return result;
+}
+
+static bool write_results(const Bench *bench, const char *path)
+{
+	FILE *f = fopen(path, "w");
+	if (!f) {
+		ERROR("Failed to open results file: %s", path);
+		return false;
+	}
+
+	fprintf(f, "{\n\t\"warmup\": %u,\n\t\"iterations\": %u,\n\t\"benchmarks\": [\n", bench->warmup, bench->iterations);
+	for (u32 i = 0; i < bench->num_results; i++) {
+		const BenchResult *r = &bench->results[i];
+		fprintf(f, "\t\t{\"name\": \"%s\", \"median_ms\": %.6f, \"p99_ms\": %.6f, \"throughput\": %.6f, \"throughput_unit\": \"%s\"",
+				r->name, r->median_ms, r->p99_ms, r->throughput, r->throughput_unit);
+		if (r->has_baseline) {
+			fprintf(f, ", \"baseline_median_ms\": %.6f, \"regressed\": %s", r->baseline_ms, r->regressed ? "true" : "false");
+		}
+		fprintf(f, "}%s\n", i + 1 < bench->num_results ? "," : "");
+	}
+	fprintf(f, "\t]\n}\n");
+
+	fclose(f);
+	INFO("Wrote benchmark results to %s", path);
+	return true;
+}
+
+// The baseline is a results file from an earlier run. Only the median of each
+// benchmark is read, by name; a benchmark the baseline lacks is reported, so a
+// comparison never quietly covers less than the run.
+static u32 compare_baseline(Bench *bench, const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		ERROR("Failed to open baseline file: %s", path);
+		return 0;
+	}
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	char *text = malloc(size + 1);
+	size_t read = fread(text, 1, size, f);
+	text[read] = 0;
+	fclose(f);
+
+	u32 regressions = 0;
+	for (u32 i = 0; i < bench->num_results; i++) {
+		BenchResult *r = &bench->results[i];
+
+		char key[BENCH_NAME_LENGTH + 16];
+		snprintf(key, sizeof(key), "\"name\": \"%s\"", r->name);
+		const char *entry = strstr(text, key);
+		const char *median = entry ? strstr(entry, "\"median_ms\":") : NULL;
+		if (!median) {
+			WARN("The baseline has no result for %s.", r->name);
+			continue;
+		}
+
+		r->has_baseline = true;
+		r->baseline_ms = strtod(median + strlen("\"median_ms\":"), NULL);
+		r->regressed = r->median_ms > r->baseline_ms * (1.0 + bench->threshold);
+		if (r->regressed) {
+			WARN("Regression in %s: %.4f ms, baseline %.4f ms (+%.1f%%).", r->name, r->median_ms, r->baseline_ms, 100.0 * (r->median_ms / r->baseline_ms - 1.0));
+			regressions++;
+		}
+	}
+
+	free(text);
+	return regressions;
+}
+
+int main(int argc, char const *argv[])
+{
+	Bench bench = {};
+	bench.warmup = 5;
+	bench.iterations = 50;
+	bench.threshold = 0.1;
+
+	const char *output_path = "bench_results.json";
+	const char *baseline_path = NULL;
+	bool headless = false;
+
+	for (i32 i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+			bench.iterations = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+			bench.warmup = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+			output_path = argv[++i];
+		} else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+			baseline_path = argv[++i];
+		} else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+			bench.threshold = atof(argv[++i]) / 100.0;
+		} else if (strcmp(argv[i], "--headless") == 0) {
+			headless = true;
+		} else {
+			printf("Usage: %s [--iterations N] [--warmup N] [--out results.json] [--baseline baseline.json] [--threshold percent] [--headless]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (bench.iterations < 1) bench.iterations = 1;
+	if (bench.iterations > BENCH_MAX_SAMPLES) bench.iterations = BENCH_MAX_SAMPLES;
+
+	const u32 width = 1280;
+	const u32 height = 720;
+
+	static GraphicsData graphics_data;
+	Window window;
+	if (headless) {
+#ifdef GRAPHICS_HEADLESS
+		window = graphics_create_headless(&graphics_data, width, height);
+#else
+		ERROR("Built without GRAPHICS_HEADLESS.");
+		return 1;
+#endif
+	} else {
+		window = graphics_create_window(&graphics_data, width, height, "Benchmark");
+		glfwSwapInterval(0);
+	}
+	if (window == -1) {
+		return 1;
+	}
+
+	// A missing asset fails the run, rather than leaving out benchmarks, so that
+	// results and baselines always cover the same work
+	const char *models[] = {"bunny", "dragon", "monkey"};
+	const char *texture_path = "res/sandbox/bricks.png";
+	const char *font_path = "res/sandbox/CourierNew.ttf";
+	char model_paths[sizeof(models) / sizeof(models[0])][256];
+	bool missing = false;
+	for (u32 i = 0; i < sizeof(models) / sizeof(models[0]); i++) {
+		snprintf(model_paths[i], sizeof(model_paths[i]), "res/sandbox/%s.obj", models[i]);
+		if (!file_exists(model_paths[i])) {
+			ERROR("Benchmark asset %s is missing.", model_paths[i]);
+			missing = true;
+		}
+	}
+	if (!file_exists(texture_path) || !file_exists(font_path)) {
+		ERROR("Benchmark asset %s or %s is missing.", texture_path, font_path);
+		missing = true;
+	}
+	if (missing) {
+		graphics_destroy_window(&graphics_data, &window);
+		return 1;
+	}
+
+	// Loading
+	for (u32 i = 0; i < sizeof(models) / sizeof(models[0]); i++) {
+		char name[BENCH_NAME_LENGTH];
+		snprintf(name, sizeof(name), "obj_load_%s", models[i]);
+		bench_run(&bench, name, bench_obj_load, model_paths[i], file_size_mb(model_paths[i]), "MB/s");
+	}
+	bench_run(&bench, "texture_load", bench_texture_load, (void *) texture_path, 1.0, "loads/s");
+
+	// Drawing
+	DrawBench draw = {};
+	draw.graphics_data = &graphics_data;
+	draw.window = window;
+	draw.texture = texture_load(texture_path);
+	draw.font = font_load(font_path, 32.0f);
+	draw.ortho = mat4_ortho(0, width, height, 0, -1.0f, 100.0f);
+	Camera camera = {{vec3_zero(), vec3_new(1, 1, 1), quat_null_rotation()}, mat4_perspective(70.0f, (f32) width / height, 0.1f, 1000.0f)};
+	draw.view_projection = camera_view_projection(&camera);
+
+	draw.mesh = obj_load_mesh("res/sandbox/monkey.obj");
+	draw.type = DRAW_MESH;
+	bench_run(&bench, "draw_mesh", bench_draws, &draw, BENCH_DRAWS_PER_FRAME, "draws/s");
+	draw.type = DRAW_RECT;
+	bench_run(&bench, "draw_rect", bench_draws, &draw, BENCH_DRAWS_PER_FRAME, "draws/s");
+	draw.type = DRAW_TEXT;
+	bench_run(&bench, "draw_text", bench_draws, &draw, BENCH_DRAWS_PER_FRAME, "draws/s");
+
+	// Maths
+	for (u32 i = 0; i < BENCH_TRANSFORMS_PER_ITERATION; i++) {
+		Transform t = {vec3_new(i, 2.0f * i, 3.0f), vec3_new(1, 2, 3), quat_from_axis_angle(vec3_new(0, 1, 0), 0.001f * i)};
+		transforms[i] = t;
+	}
+	bench_run(&bench, "mat4_transformation", bench_mat4_transformation, NULL, BENCH_TRANSFORMS_PER_ITERATION / 1000000.0, "M/s");
+
+	u32 regressions = baseline_path ? compare_baseline(&bench, baseline_path) : 0;
+	write_results(&bench, output_path);
+
+	graphics_destroy_window(&graphics_data, &window);
+
+	if (regressions) {
+		ERROR("%u benchmark(s) regressed by more than %.0f%%.", regressions, 100.0 * bench.threshold);
+		return 2;
+	}
+	return 0;
+}
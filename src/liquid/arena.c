@@ -0,0 +1,78 @@
+#include "arena.h"
+
+#include <stdlib.h>
+
+#define CHUNK_DATA(chunk) ((u8 *) (chunk) + sizeof(ArenaChunk))
+
+static ArenaChunk *arena_new_chunk(Arena *arena, size_t min_size)
+{
+	size_t capacity = arena->chunk_size > min_size ? arena->chunk_size : min_size;
+
+	ArenaChunk *result = malloc(sizeof(ArenaChunk) + capacity);
+	if (result == NULL) {
+		FATAL("Failed to allocate arena chunk of %zu bytes.", capacity);
+	}
+	result->next = NULL;
+	result->capacity = capacity;
+	result->used = 0;
+
+	arena->total_capacity += capacity;
+
+	return result;
+}
+
+void arena_init(Arena *arena, size_t chunk_size)
+{
+	arena->chunk_size = chunk_size ? chunk_size : ARENA_DEFAULT_CHUNK_SIZE;
+	arena->total_capacity = 0;
+	arena->first = arena_new_chunk(arena, 0);
+	arena->current = arena->first;
+}
+
+void arena_destroy(Arena *arena)
+{
+	ArenaChunk *chunk = arena->first;
+	while (chunk) {
+		ArenaChunk *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+
+	arena->first = NULL;
+	arena->current = NULL;
+	arena->total_capacity = 0;
+}
+
+void *arena_push(Arena *arena, size_t size, size_t alignment)
+{
+	if (arena->first == NULL) {
+		arena_init(arena, arena->chunk_size);
+	}
+
+	for (;;) {
+		ArenaChunk *chunk = arena->current;
+		uintptr_t base = (uintptr_t) CHUNK_DATA(chunk);
+		uintptr_t start = (base + chunk->used + alignment - 1) & ~(uintptr_t) (alignment - 1);
+
+		if (start + size <= base + chunk->capacity) {
+			chunk->used = start + size - base;
+			return (void *) start;
+		}
+
+		// Reuse the chunks kept from previous frames before allocating a new one.
+		// Chunks further down the list are reset lazily as we reach them.
+		if (chunk->next == NULL) {
+			chunk->next = arena_new_chunk(arena, size + alignment);
+		}
+		arena->current = chunk->next;
+		arena->current->used = 0;
+	}
+}
+
+void arena_reset(Arena *arena)
+{
+	if (arena->first) {
+		arena->current = arena->first;
+		arena->current->used = 0;
+	}
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "common.h"
+
+#include <stddef.h>
+
+#define ARENA_DEFAULT_CHUNK_SIZE (1024 * 1024)
+#define ARENA_DEFAULT_ALIGNMENT 16
+
+typedef struct ArenaChunk
+{
+	struct ArenaChunk *next;
+	size_t capacity;
+	size_t used;
+} ArenaChunk;
+
+// Linear allocator made of a list of chunks. Chunks are never returned to the
+// system before arena_destroy, so after the first few frames pushing is just a
+// pointer bump and arena_reset does not touch any memory.
+typedef struct
+{
+	ArenaChunk *first;
+	ArenaChunk *current;
+	size_t chunk_size;
+	size_t total_capacity;
+} Arena;
+
+void arena_init(Arena *arena, size_t chunk_size);
+void arena_destroy(Arena *arena);
+void *arena_push(Arena *arena, size_t size, size_t alignment);
+void arena_reset(Arena *arena);
@@ -0,0 +1,532 @@
+#include "command_capture.h"
+#include "obj_loading.h"
+#include "cpu_profiler.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+	FILE *file;
+	u32 session;
+	u32 frames;
+	u64 commands;
+
+	// A whole flush is serialized here first and written with one fwrite
+	u8 *buffer;
+	size_t size;
+	size_t capacity;
+} CommandCapture;
+
+static CommandCapture command_capture;
+
+/* -- Capture -- */
+
+static void push_bytes(const void *data, size_t size)
+{
+	CommandCapture *capture = &command_capture;
+	if (capture->size + size > capture->capacity) {
+		capture->capacity = capture->capacity ? capture->capacity : 64 * 1024;
+		while (capture->size + size > capture->capacity) {
+			capture->capacity *= 2;
+		}
+		capture->buffer = realloc(capture->buffer, capture->capacity);
+	}
+	memcpy(capture->buffer + capture->size, data, size);
+	capture->size += size;
+}
+
+static void push_u8(u8 value) { push_bytes(&value, sizeof(value)); }
+static void push_u16(u16 value) { push_bytes(&value, sizeof(value)); }
+static void push_u32(u32 value) { push_bytes(&value, sizeof(value)); }
+
+bool command_capture_begin(GraphicsData *graphics_data, const char *path)
+{
+	CommandCapture *capture = &command_capture;
+	command_capture_end();
+
+	capture->file = fopen(path, "wb");
+	if (!capture->file) {
+		ERROR("Failed to open command capture: %s", path);
+		return false;
+	}
+
+	// Every resource is written out again for a new capture
+	capture->session++;
+	capture->frames = 0;
+	capture->commands = 0;
+
+	u32 header[2] = {COMMAND_CAPTURE_MAGIC, COMMAND_CAPTURE_VERSION};
+	fwrite(header, sizeof(header), 1, capture->file);
+	command_capture_write_layers(graphics_data->layers, GRAPHICS_MAX_LAYERS);
+	INFO("Capturing draw commands to %s", path);
+	return true;
+}
+
+void command_capture_end()
+{
+	CommandCapture *capture = &command_capture;
+	if (!capture->file) {
+		return;
+	}
+
+	fclose(capture->file);
+	capture->file = NULL;
+	INFO("Captured %u frames, %llu commands.", capture->frames, (unsigned long long) capture->commands);
+}
+
+bool command_capture_active()
+{
+	return command_capture.file != NULL;
+}
+
+static void reference_resource(ResourceKind kind, u32 id)
+{
+	ResourceEntry *entry = resource_registry_get(kind, id);
+	if (entry->capture_session == command_capture.session) {
+		return;
+	}
+	entry->capture_session = command_capture.session;
+
+	u16 length = entry->path ? (u16) strlen(entry->path) : 0;
+	push_u8(COMMAND_RECORD_RESOURCE);
+	push_u8(kind);
+	push_u32(id);
+	push_bytes(&entry->size, sizeof(f32));
+	push_u16(length);
+	push_bytes(entry->path, length);
+}
+
+static void reference_resources(const DrawCommand *cmd)
+{
+	switch (cmd->type) {
+		case DRAW_TRIANGLE:
+			reference_resource(RESOURCE_TEXTURE, ((const DrawTriangleCommandData *) cmd->data)->texture.id);
+			break;
+		case DRAW_RECT:
+			reference_resource(RESOURCE_TEXTURE, ((const DrawRectCommandData *) cmd->data)->texture.id);
+			break;
+		case DRAW_MESH:
+			reference_resource(RESOURCE_MESH, ((const DrawMeshCommandData *) cmd->data)->mesh.id);
+			reference_resource(RESOURCE_TEXTURE, ((const DrawMeshCommandData *) cmd->data)->texture.id);
+			break;
+		case DRAW_TEXT:
+			reference_resource(RESOURCE_FONT, ((const DrawTextCommandData *) cmd->data)->font.texture.id);
+			break;
+	}
+}
+
+static const mat4 *command_projection(const DrawCommand *cmd)
+{
+	switch (cmd->type) {
+		case DRAW_TRIANGLE: return &((const DrawTriangleCommandData *) cmd->data)->projection;
+		case DRAW_RECT: return &((const DrawRectCommandData *) cmd->data)->projection;
+		case DRAW_MESH: return &((const DrawMeshCommandData *) cmd->data)->projection;
+		case DRAW_TEXT: return &((const DrawTextCommandData *) cmd->data)->projection;
+	}
+	return NULL;
+}
+
+static void push_command(const DrawCommand *cmd, const mat4 **projection)
+{
+	const mat4 *cmd_projection = command_projection(cmd);
+	bool new_projection = *projection == NULL || memcmp(*projection, cmd_projection, sizeof(mat4)) != 0;
+	*projection = cmd_projection;
+
+	u8 flags = new_projection ? COMMAND_FLAG_PROJECTION : 0;
+	if (cmd->type == DRAW_MESH && ((const DrawMeshCommandData *) cmd->data)->has_parent) {
+		flags |= COMMAND_FLAG_PARENT;
+	}
+
+	push_u8(cmd->type);
+	push_u8(flags);
+	push_u32(cmd->layer);
+	if (new_projection) {
+		push_bytes(cmd_projection, sizeof(mat4));
+	}
+
+	switch (cmd->type) {
+		case DRAW_TRIANGLE:
+		case DRAW_RECT: {
+			// Triangle and rect payloads have the same layout
+			const DrawRectCommandData *data = cmd->data;
+			push_bytes(&data->transform, sizeof(Transform));
+			push_u32(data->texture.id);
+			push_bytes(&data->color, sizeof(vec4));
+		} break;
+		case DRAW_MESH: {
+			const DrawMeshCommandData *data = cmd->data;
+			push_u32(data->mesh.id);
+			push_bytes(&data->transform, sizeof(Transform));
+			push_u32(data->texture.id);
+			push_bytes(&data->color, sizeof(vec4));
+			if (data->has_parent) {
+				push_bytes(&data->parent, sizeof(mat4));
+			}
+		} break;
+		case DRAW_TEXT: {
+			const DrawTextCommandData *data = cmd->data;
+			u16 length = (u16) strlen(data->text);
+			push_u32(data->font.texture.id);
+			push_bytes(&data->transform, sizeof(Transform));
+			push_u16(length);
+			push_bytes(data->text, length);
+		} break;
+	}
+}
+
+void command_capture_write_flush(const CommandBucket *buckets, u32 num_buckets)
+{
+	PROFILE_FUNCTION();
+
+	CommandCapture *capture = &command_capture;
+	capture->size = 0;
+
+	// Culled commands are captured too, so that a replay culls them itself
+	u32 count = 0;
+	for (u32 i = 0; i < num_buckets; i++) {
+		for (size_t j = 0; j < buckets[i].submitted; j++) {
+			reference_resources(buckets[i].entries[j].cmd);
+		}
+		count += buckets[i].submitted;
+	}
+
+	push_u8(COMMAND_RECORD_FLUSH);
+	push_u32(count);
+	const mat4 *projection = NULL;
+	for (u32 i = 0; i < num_buckets; i++) {
+		for (size_t j = 0; j < buckets[i].submitted; j++) {
+			push_command(buckets[i].entries[j].cmd, &projection);
+		}
+	}
+
+	fwrite(capture->buffer, 1, capture->size, capture->file);
+	capture->commands += count;
+}
+
+void command_capture_write_end_frame()
+{
+	u8 type = COMMAND_RECORD_END_FRAME;
+	fwrite(&type, 1, 1, command_capture.file);
+	command_capture.frames++;
+}
+
+void command_capture_write_layers(const LayerConfig *layers, u32 num_layers)
+{
+	CommandCapture *capture = &command_capture;
+	capture->size = 0;
+
+	push_u8(COMMAND_RECORD_LAYERS);
+	push_u32(num_layers);
+	for (u32 i = 0; i < num_layers; i++) {
+		push_u8(layers[i].sort);
+		push_u8(layers[i].depth_test);
+		push_u8(layers[i].depth_write);
+		push_u8(layers[i].blend);
+	}
+
+	fwrite(capture->buffer, 1, capture->size, capture->file);
+}
+
+/* -- Replay -- */
+
+bool command_replay_open(CommandReplay *replay, const char *path)
+{
+	CommandReplay empty = {};
+	*replay = empty;
+
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		ERROR("Failed to open command capture: %s", path);
+		return false;
+	}
+	fseek(file, 0, SEEK_END);
+	replay->size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	replay->data = malloc(replay->size);
+	size_t read = fread(replay->data, 1, replay->size, file);
+	fclose(file);
+
+	u32 header[2] = {};
+	if (read != replay->size || replay->size < sizeof(header)) {
+		ERROR("Failed to read command capture: %s", path);
+		command_replay_close(replay);
+		return false;
+	}
+	memcpy(header, replay->data, sizeof(header));
+	if (header[0] != COMMAND_CAPTURE_MAGIC || header[1] != COMMAND_CAPTURE_VERSION) {
+		ERROR("%s is not a version %d command capture.", path, COMMAND_CAPTURE_VERSION);
+		command_replay_close(replay);
+		return false;
+	}
+
+	replay->cursor = sizeof(header);
+	return true;
+}
+
+void command_replay_close(CommandReplay *replay)
+{
+	for (u32 i = 0; i < replay->num_resources[RESOURCE_MESH]; i++) {
+		ReplayResource *resource = &replay->resources[RESOURCE_MESH][i];
+		if (resource->loaded && !resource->missing) mesh_destroy(&resource->mesh);
+	}
+	for (u32 i = 0; i < replay->num_resources[RESOURCE_TEXTURE]; i++) {
+		ReplayResource *resource = &replay->resources[RESOURCE_TEXTURE][i];
+		if (resource->loaded && !resource->missing) texture_destroy(&resource->texture);
+	}
+	for (u32 i = 0; i < replay->num_resources[RESOURCE_FONT]; i++) {
+		ReplayResource *resource = &replay->resources[RESOURCE_FONT][i];
+		if (resource->loaded && !resource->missing) font_destroy(&resource->font);
+	}
+	if (replay->placeholder.id) {
+		texture_destroy(&replay->placeholder);
+	}
+
+	for (u32 i = 0; i < RESOURCE_NUM_KINDS; i++) {
+		free(replay->resources[i]);
+	}
+	free(replay->data);
+
+	CommandReplay empty = {};
+	*replay = empty;
+}
+
+void command_replay_rewind(CommandReplay *replay)
+{
+	replay->cursor = 2 * sizeof(u32);
+}
+
+static bool read_bytes(CommandReplay *replay, void *data, size_t size)
+{
+	if (replay->cursor + size > replay->size) {
+		ERROR("Command capture is truncated.");
+		replay->cursor = replay->size;
+		return false;
+	}
+	memcpy(data, replay->data + replay->cursor, size);
+	replay->cursor += size;
+	return true;
+}
+
+static bool file_exists(const char *path)
+{
+	FILE *file = fopen(path, "rb");
+	if (file) {
+		fclose(file);
+	}
+	return file != NULL;
+}
+
+static bool read_resource(CommandReplay *replay)
+{
+	u8 kind;
+	u32 id;
+	f32 size;
+	u16 length;
+	char path[UINT16_MAX + 1];
+	if (!read_bytes(replay, &kind, 1) || !read_bytes(replay, &id, 4) || !read_bytes(replay, &size, 4) ||
+		!read_bytes(replay, &length, 2) || !read_bytes(replay, path, length)) {
+		return false;
+	}
+	path[length] = 0;
+	if (kind >= RESOURCE_NUM_KINDS) {
+		ERROR("Unknown resource kind in command capture: %d", kind);
+		return false;
+	}
+
+	if (id >= replay->num_resources[kind]) {
+		u32 count = id + 1;
+		replay->resources[kind] = realloc(replay->resources[kind], count * sizeof(ReplayResource));
+		memset(&replay->resources[kind][replay->num_resources[kind]], 0, (count - replay->num_resources[kind]) * sizeof(ReplayResource));
+		replay->num_resources[kind] = count;
+	}
+
+	// Already loaded on an earlier pass over the capture
+	ReplayResource *resource = &replay->resources[kind][id];
+	if (resource->loaded) {
+		return true;
+	}
+	resource->loaded = true;
+
+	if (length == 0 || !file_exists(path)) {
+		WARN("Resource %u of kind %d can not be loaded%s%s.", id, kind, length ? " from " : "", path);
+		resource->missing = true;
+		return true;
+	}
+
+	switch (kind) {
+		case RESOURCE_MESH: resource->mesh = obj_load_mesh(path); break;
+		case RESOURCE_TEXTURE: resource->texture = texture_load(path); break;
+		case RESOURCE_FONT: resource->font = font_load(path, size); break;
+	}
+	return true;
+}
+
+static ReplayResource *find_resource(CommandReplay *replay, ResourceKind kind, u32 id)
+{
+	if (id >= replay->num_resources[kind] || replay->resources[kind][id].missing) {
+		return NULL;
+	}
+	return &replay->resources[kind][id];
+}
+
+static Texture find_texture(CommandReplay *replay, u32 id)
+{
+	ReplayResource *resource = find_resource(replay, RESOURCE_TEXTURE, id);
+	if (resource) {
+		return resource->texture;
+	}
+
+	if (replay->placeholder.id == 0) {
+		u8 *white = malloc(3);
+		memset(white, 0xff, 3);
+		texture_init(&replay->placeholder, 1, 1, GL_RGB, GL_UNSIGNED_BYTE, white);
+	}
+	return replay->placeholder;
+}
+
+static bool replay_layers(CommandReplay *replay, GraphicsData *graphics_data)
+{
+	u32 count;
+	if (!read_bytes(replay, &count, 4)) {
+		return false;
+	}
+
+	for (u32 i = 0; i < count; i++) {
+		u8 fields[4];
+		if (!read_bytes(replay, fields, sizeof(fields))) {
+			return false;
+		}
+
+		// Layers past this build's maximum have no commands that could use them
+		if (i < GRAPHICS_MAX_LAYERS) {
+			LayerConfig config = {fields[0], fields[1], fields[2], fields[3]};
+			graphics_set_layer(graphics_data, i, &config);
+		}
+	}
+	return true;
+}
+
+static bool replay_flush(CommandReplay *replay, GraphicsData *graphics_data)
+{
+	u32 count;
+	if (!read_bytes(replay, &count, 4)) {
+		return false;
+	}
+
+	mat4 projection = mat4_identity();
+	for (u32 i = 0; i < count; i++) {
+		u8 type, flags;
+		u32 layer;
+		if (!read_bytes(replay, &type, 1) || !read_bytes(replay, &flags, 1) || !read_bytes(replay, &layer, 4)) {
+			return false;
+		}
+		if (flags & COMMAND_FLAG_PROJECTION) {
+			if (!read_bytes(replay, &projection, sizeof(mat4))) {
+				return false;
+			}
+		}
+
+		DrawCommand cmd = {type, layer, 0, NULL};
+		union
+		{
+			DrawTriangleCommandData triangle;
+			DrawRectCommandData rect;
+			DrawMeshCommandData mesh;
+			DrawTextCommandData text;
+		} data;
+		char text[UINT16_MAX + 1];
+		bool skip = false;
+
+		switch (type) {
+			case DRAW_TRIANGLE:
+			case DRAW_RECT: {
+				u32 texture_id;
+				if (!read_bytes(replay, &data.rect.transform, sizeof(Transform)) || !read_bytes(replay, &texture_id, 4) ||
+					!read_bytes(replay, &data.rect.color, sizeof(vec4))) {
+					return false;
+				}
+				data.rect.projection = projection;
+				data.rect.texture = find_texture(replay, texture_id);
+			} break;
+			case DRAW_MESH: {
+				u32 mesh_id, texture_id;
+				if (!read_bytes(replay, &mesh_id, 4) || !read_bytes(replay, &data.mesh.transform, sizeof(Transform)) ||
+					!read_bytes(replay, &texture_id, 4) || !read_bytes(replay, &data.mesh.color, sizeof(vec4))) {
+					return false;
+				}
+				data.mesh.has_parent = (flags & COMMAND_FLAG_PARENT) != 0;
+				if (data.mesh.has_parent && !read_bytes(replay, &data.mesh.parent, sizeof(mat4))) {
+					return false;
+				}
+				ReplayResource *mesh = find_resource(replay, RESOURCE_MESH, mesh_id);
+				skip = mesh == NULL;
+				if (mesh) {
+					data.mesh.mesh = mesh->mesh;
+				}
+				data.mesh.projection = projection;
+				data.mesh.texture = find_texture(replay, texture_id);
+			} break;
+			case DRAW_TEXT: {
+				u32 font_id;
+				u16 length;
+				if (!read_bytes(replay, &font_id, 4) || !read_bytes(replay, &data.text.transform, sizeof(Transform)) ||
+					!read_bytes(replay, &length, 2) || !read_bytes(replay, text, length)) {
+					return false;
+				}
+				text[length] = 0;
+				ReplayResource *font = find_resource(replay, RESOURCE_FONT, font_id);
+				skip = font == NULL;
+				if (font) {
+					data.text.font = font->font;
+				}
+				data.text.text = text;
+				data.text.projection = projection;
+			} break;
+			default:
+				ERROR("Unknown draw command type in command capture: %d", type);
+				return false;
+		}
+
+		if (skip) {
+			replay->skipped_commands++;
+			continue;
+		}
+		cmd.data = &data;
+		graphics_submit_call(graphics_data, &cmd);
+	}
+
+	graphics_sort_and_flush_queue(graphics_data);
+	return true;
+}
+
+bool command_replay_frame(CommandReplay *replay, GraphicsData *graphics_data, Window *window)
+{
+	if (replay->cursor >= replay->size || *window == -1) {
+		return false;
+	}
+
+	graphics_begin_frame(graphics_data, window);
+	while (replay->cursor < replay->size) {
+		u8 type = replay->data[replay->cursor++];
+		bool ok = true;
+		if (type == COMMAND_RECORD_RESOURCE) {
+			ok = read_resource(replay);
+		} else if (type == COMMAND_RECORD_FLUSH) {
+			ok = replay_flush(replay, graphics_data);
+		} else if (type == COMMAND_RECORD_LAYERS) {
+			ok = replay_layers(replay, graphics_data);
+		} else if (type == COMMAND_RECORD_END_FRAME) {
+			break;
+		} else {
+			ERROR("Unknown record in command capture at offset %zu.", replay->cursor - 1);
+			ok = false;
+		}
+
+		if (!ok) {
+			replay->cursor = replay->size;
+		}
+	}
+	graphics_end_frame(graphics_data, window);
+	return true;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "common.h"
+#include "graphics.h"
+#include "resource_registry.h"
+
+#define COMMAND_CAPTURE_MAGIC 0x5343514c // "LQCS"
+#define COMMAND_CAPTURE_VERSION 3
+
+// A capture is a header followed by records, each starting with a u8 type:
+//   RESOURCE   u8 kind, u32 id, f32 size, u16 path length, path
+//              Written before the first command that references the id.
+//              An empty path marks a resource that was not loaded from a file.
+//   FLUSH      u32 count, then count commands of
+//              u8 type, u8 flags, u32 layer, [mat4 projection], payload
+//              The projection is only written when it differs from the
+//              previous command's (COMMAND_FLAG_PROJECTION). Mesh payloads
+//              end in a mat4 parent when they have one (COMMAND_FLAG_PARENT).
+//   END_FRAME
+//   LAYERS     u32 count, then count layers of
+//              u8 sort, u8 depth_test, u8 depth_write, u8 blend
+//              Written when the capture begins and whenever a layer changes.
+// Values are written in native byte order and layout, so a capture is
+// replayed by a build for the same platform.
+typedef enum
+{
+	COMMAND_RECORD_RESOURCE = 1,
+	COMMAND_RECORD_FLUSH,
+	COMMAND_RECORD_END_FRAME,
+	COMMAND_RECORD_LAYERS,
+} CommandRecordType;
+
+#define COMMAND_FLAG_PROJECTION 0x1
+#define COMMAND_FLAG_PARENT 0x2
+
+// Capturing is global, like the mesh buffer; it records the queue of every
+// graphics_sort_and_flush_queue, culled commands included, the frame
+// boundaries from graphics_end_frame and the layers of graphics_set_layer.
+bool command_capture_begin(GraphicsData *graphics_data, const char *path);
+void command_capture_end();
+bool command_capture_active();
+
+void command_capture_write_flush(const CommandBucket *buckets, u32 num_buckets);
+void command_capture_write_end_frame();
+void command_capture_write_layers(const LayerConfig *layers, u32 num_layers);
+
+typedef struct
+{
+	bool loaded;
+	bool missing; // Not loaded from a file, or the file is gone
+	Mesh mesh;
+	Texture texture;
+	Font font;
+} ReplayResource;
+
+typedef struct
+{
+	u8 *data;
+	size_t size;
+	size_t cursor;
+
+	// Indexed by kind and by the id in the capture
+	ReplayResource *resources[RESOURCE_NUM_KINDS];
+	u32 num_resources[RESOURCE_NUM_KINDS];
+
+	Texture placeholder; // Stands in for textures that could not be loaded
+	u32 skipped_commands;
+} CommandReplay;
+
+// Loads the whole capture into memory, so replay does no file IO
+bool command_replay_open(CommandReplay *replay, const char *path);
+void command_replay_close(CommandReplay *replay);
+
+// Re-issues the next captured frame between graphics_begin_frame and
+// graphics_end_frame. Resources are loaded from their paths the first time
+// they appear. Returns false at the end of the capture or once the window
+// was closed.
+bool command_replay_frame(CommandReplay *replay, GraphicsData *graphics_data, Window *window);
+void command_replay_rewind(CommandReplay *replay);
@@ -0,0 +1,157 @@
+#include "cpu_profiler.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+static ProfileThread *profile_threads;
+static u32 profile_thread_count;
+static _Thread_local ProfileThread *profile_thread;
+
+// Its destructor hands the ring of an exiting thread back
+static pthread_key_t profile_thread_key;
+static pthread_once_t profile_thread_key_once = PTHREAD_ONCE_INIT;
+
+// Nanoseconds on the monotonic clock. Unlike raw rdtsc this needs no
+// calibration and is comparable between cores.
+u64 cpu_profiler_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64) ts.tv_sec * 1000000000ull + (u64) ts.tv_nsec;
+}
+
+static void release_thread(void *data)
+{
+	ProfileThread *thread = data;
+	__atomic_store_n(&thread->in_use, false, __ATOMIC_RELEASE);
+}
+
+static void create_thread_key()
+{
+	pthread_key_create(&profile_thread_key, release_thread);
+}
+
+// Takes over the ring of a thread that has exited; its events are dropped
+static ProfileThread *reuse_thread()
+{
+	for (ProfileThread *thread = __atomic_load_n(&profile_threads, __ATOMIC_ACQUIRE); thread; thread = thread->next) {
+		bool expected = false;
+		if (!__atomic_load_n(&thread->in_use, __ATOMIC_RELAXED) &&
+			__atomic_compare_exchange_n(&thread->in_use, &expected, true, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			__atomic_store_n(&thread->head, 0, __ATOMIC_RELEASE);
+			return thread;
+		}
+	}
+	return NULL;
+}
+
+// Threads are added to a lock-free list the first time they record, and stay
+// in it, so the exporter can walk it at any time. Rings of exited threads are
+// reused, so short-lived threads do not add up.
+static ProfileThread *get_thread()
+{
+	if (profile_thread == NULL) {
+		pthread_once(&profile_thread_key_once, create_thread_key);
+
+		ProfileThread *thread = reuse_thread();
+		if (!thread) {
+			thread = calloc(1, sizeof(ProfileThread));
+			thread->in_use = true;
+			thread->next = __atomic_load_n(&profile_threads, __ATOMIC_RELAXED);
+			while (!__atomic_compare_exchange_n(&profile_threads, &thread->next, thread, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+			}
+		}
+		thread->id = __atomic_add_fetch(&profile_thread_count, 1, __ATOMIC_RELAXED);
+		snprintf(thread->name, CPU_PROFILER_NAME_LENGTH, "thread %u", thread->id);
+
+		pthread_setspecific(profile_thread_key, thread);
+		profile_thread = thread;
+	}
+	return profile_thread;
+}
+
+ProfileScope cpu_profiler_begin(const char *name)
+{
+	ProfileScope result = {name, cpu_profiler_now()};
+	return result;
+}
+
+void cpu_profiler_end(ProfileScope *scope)
+{
+	u64 end = cpu_profiler_now();
+	ProfileThread *thread = get_thread();
+
+	u64 head = thread->head;
+	ProfileEvent *event = &thread->events[head % CPU_PROFILER_EVENTS_PER_THREAD];
+	event->name = scope->name;
+	event->begin = scope->begin;
+	event->end = end;
+	__atomic_store_n(&thread->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void cpu_profiler_set_thread_name(const char *name)
+{
+	ProfileThread *thread = get_thread();
+	strncpy(thread->name, name, CPU_PROFILER_NAME_LENGTH - 1);
+	thread->name[CPU_PROFILER_NAME_LENGTH - 1] = 0;
+}
+
+static void write_json_string(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\') {
+			fputc('\\', f);
+		}
+		if ((u8) *s >= 32) {
+			fputc(*s, f);
+		}
+	}
+	fputc('"', f);
+}
+
+// Complete ("X") events with microsecond timestamps, plus one metadata event
+// per thread for its name. Events a thread overwrites while this runs may come
+// out torn, so export when the threads are quiet, e.g. at shutdown.
+bool cpu_profiler_export_chrome_trace(const char *path)
+{
+#ifndef PROFILE_CPU
+	WARN("Built without PROFILE_CPU, %s will hold no events.", path);
+#endif
+
+	FILE *f = fopen(path, "w");
+	if (!f) {
+		ERROR("Failed to open trace file: %s", path);
+		return false;
+	}
+
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	bool first = true;
+	u32 num_events = 0;
+
+	for (ProfileThread *thread = __atomic_load_n(&profile_threads, __ATOMIC_ACQUIRE); thread; thread = thread->next) {
+		fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", first ? "" : ",\n", thread->id);
+		write_json_string(f, thread->name);
+		fprintf(f, "}}");
+		first = false;
+
+		u64 head = __atomic_load_n(&thread->head, __ATOMIC_ACQUIRE);
+		u64 start = head > CPU_PROFILER_EVENTS_PER_THREAD ? head - CPU_PROFILER_EVENTS_PER_THREAD : 0;
+		for (u64 i = start; i < head; i++) {
+			const ProfileEvent *event = &thread->events[i % CPU_PROFILER_EVENTS_PER_THREAD];
+			fprintf(f, ",\n{\"name\":");
+			write_json_string(f, event->name);
+			fprintf(f, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+					thread->id, (f64) event->begin / 1000.0, (f64) (event->end - event->begin) / 1000.0);
+			num_events++;
+		}
+	}
+
+	fprintf(f, "\n]}\n");
+	fclose(f);
+
+	INFO("Wrote %u profile events to %s", num_events, path);
+	return true;
+}
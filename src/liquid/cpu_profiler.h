@@ -0,0 +1,56 @@
+#pragma once
+
+#include "common.h"
+
+#define CPU_PROFILER_EVENTS_PER_THREAD (64 * 1024)
+#define CPU_PROFILER_NAME_LENGTH 32
+
+typedef struct
+{
+	const char *name;
+	u64 begin;
+	u64 end;
+} ProfileEvent;
+
+// Ring of the most recent events of one thread. Only the owning thread writes;
+// it publishes an event by advancing head, which readers load with acquire.
+typedef struct ProfileThread
+{
+	struct ProfileThread *next;
+	bool in_use; // Cleared when the owning thread exits, so another one reuses the ring
+	u32 id;
+	char name[CPU_PROFILER_NAME_LENGTH];
+	u64 head;
+	ProfileEvent events[CPU_PROFILER_EVENTS_PER_THREAD];
+} ProfileThread;
+
+typedef struct
+{
+	const char *name;
+	u64 begin;
+} ProfileScope;
+
+// Scopes end when the enclosing block is left. Names must outlive the profiler,
+// string literals and __func__ do. Profiling is opt-in: build with -DPROFILE_CPU,
+// without it the macros compile to nothing.
+#ifdef PROFILE_CPU
+	#define _PROFILE_CONCAT2(a, b) a##b
+	#define _PROFILE_CONCAT(a, b) _PROFILE_CONCAT2(a, b)
+	#define PROFILE_SCOPE(name) \
+		ProfileScope _PROFILE_CONCAT(profile_scope_, __LINE__) __attribute__((cleanup(cpu_profiler_end))) = cpu_profiler_begin(name)
+	#define PROFILE_FUNCTION() PROFILE_SCOPE(__func__)
+	#define PROFILE_THREAD_NAME(name) cpu_profiler_set_thread_name(name)
+#else
+	#define PROFILE_SCOPE(name)
+	#define PROFILE_FUNCTION()
+	#define PROFILE_THREAD_NAME(name)
+#endif
+
+u64 cpu_profiler_now();
+ProfileScope cpu_profiler_begin(const char *name);
+void cpu_profiler_end(ProfileScope *scope);
+void cpu_profiler_set_thread_name(const char *name);
+
+// Writes the events still held by all rings as Chrome trace JSON, which
+// about:tracing and Perfetto load directly
+bool cpu_profiler_export_chrome_trace(const char *path);
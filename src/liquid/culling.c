@@ -0,0 +1,151 @@
+#include "culling.h"
+
+#if defined(__AVX__)
+	#include <immintrin.h>
+#elif defined(__SSE__)
+	#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+	#include <arm_neon.h>
+#endif
+
+// Gribb/Hartmann: a clip-space point is inside when -w <= x, y, z <= w, so each
+// plane is the fourth row of the matrix plus or minus one of the others.
+Frustum frustum_from_view_projection(const mat4 *view_projection)
+{
+	const f32 *M = view_projection->M;
+	vec4 rows[4];
+	for (u32 i = 0; i < 4; i++) {
+		rows[i] = vec4_new(M[i + 0 * 4], M[i + 1 * 4], M[i + 2 * 4], M[i + 3 * 4]);
+	}
+
+	Frustum result;
+	for (u32 i = 0; i < 3; i++) {
+		result.planes[2 * i + 0] = vec4_add(rows[3], rows[i]);
+		result.planes[2 * i + 1] = vec4_sub(rows[3], rows[i]);
+	}
+
+	for (u32 i = 0; i < 6; i++) {
+		vec4 *p = &result.planes[i];
+		f32 length = sqrtf32(p->x * p->x + p->y * p->y + p->z * p->z);
+		if (length > 0.0f) {
+			*p = vec4_scalar_div(*p, length);
+		}
+	}
+
+	return result;
+}
+
+static u32 cull_spheres_scalar(const Frustum *frustum, const f32 *x, const f32 *y, const f32 *z, const f32 *radius, u32 count, u8 *visible)
+{
+	u32 result = 0;
+	for (u32 i = 0; i < count; i++) {
+		bool inside = true;
+		for (u32 p = 0; p < 6; p++) {
+			const vec4 *plane = &frustum->planes[p];
+			f32 d = plane->x * x[i] + plane->y * y[i] + plane->z * z[i] + plane->w;
+			inside = inside && d >= -radius[i];
+		}
+		visible[i] = inside;
+		result += inside;
+	}
+	return result;
+}
+
+u32 frustum_cull_spheres(const Frustum *frustum, const f32 *x, const f32 *y, const f32 *z, const f32 *radius, u32 count, u8 *visible)
+{
+	u32 result = 0;
+	u32 i = 0;
+
+#if defined(__AVX__)
+	__m256 px[6], py[6], pz[6], pw[6];
+	for (u32 p = 0; p < 6; p++) {
+		px[p] = _mm256_set1_ps(frustum->planes[p].x);
+		py[p] = _mm256_set1_ps(frustum->planes[p].y);
+		pz[p] = _mm256_set1_ps(frustum->planes[p].z);
+		pw[p] = _mm256_set1_ps(frustum->planes[p].w);
+	}
+
+	for (; i + 8 <= count; i += 8) {
+		__m256 sx = _mm256_loadu_ps(x + i);
+		__m256 sy = _mm256_loadu_ps(y + i);
+		__m256 sz = _mm256_loadu_ps(z + i);
+		__m256 neg_r = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(radius + i));
+
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (u32 p = 0; p < 6; p++) {
+			__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px[p], sx), _mm256_mul_ps(py[p], sy)),
+									 _mm256_add_ps(_mm256_mul_ps(pz[p], sz), pw[p]));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, neg_r, _CMP_GE_OQ));
+		}
+
+		u32 mask = _mm256_movemask_ps(inside);
+		for (u32 k = 0; k < 8; k++) {
+			visible[i + k] = (mask >> k) & 1;
+		}
+		result += __builtin_popcount(mask);
+	}
+#elif defined(__SSE__)
+	// Two groups of four per iteration, so both dependency chains overlap
+	__m128 px[6], py[6], pz[6], pw[6];
+	for (u32 p = 0; p < 6; p++) {
+		px[p] = _mm_set1_ps(frustum->planes[p].x);
+		py[p] = _mm_set1_ps(frustum->planes[p].y);
+		pz[p] = _mm_set1_ps(frustum->planes[p].z);
+		pw[p] = _mm_set1_ps(frustum->planes[p].w);
+	}
+
+	for (; i + 8 <= count; i += 8) {
+		__m128 sx0 = _mm_loadu_ps(x + i), sx1 = _mm_loadu_ps(x + i + 4);
+		__m128 sy0 = _mm_loadu_ps(y + i), sy1 = _mm_loadu_ps(y + i + 4);
+		__m128 sz0 = _mm_loadu_ps(z + i), sz1 = _mm_loadu_ps(z + i + 4);
+		__m128 neg_r0 = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(radius + i));
+		__m128 neg_r1 = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(radius + i + 4));
+
+		__m128 inside0 = _mm_cmpeq_ps(sx0, sx0);
+		__m128 inside1 = _mm_cmpeq_ps(sx1, sx1);
+		for (u32 p = 0; p < 6; p++) {
+			__m128 d0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px[p], sx0), _mm_mul_ps(py[p], sy0)),
+								   _mm_add_ps(_mm_mul_ps(pz[p], sz0), pw[p]));
+			__m128 d1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px[p], sx1), _mm_mul_ps(py[p], sy1)),
+								   _mm_add_ps(_mm_mul_ps(pz[p], sz1), pw[p]));
+			inside0 = _mm_and_ps(inside0, _mm_cmpge_ps(d0, neg_r0));
+			inside1 = _mm_and_ps(inside1, _mm_cmpge_ps(d1, neg_r1));
+		}
+
+		u32 mask = _mm_movemask_ps(inside0) | (_mm_movemask_ps(inside1) << 4);
+		for (u32 k = 0; k < 8; k++) {
+			visible[i + k] = (mask >> k) & 1;
+		}
+		result += __builtin_popcount(mask);
+	}
+#elif defined(__ARM_NEON)
+	for (; i + 8 <= count; i += 8) {
+		float32x4_t sx0 = vld1q_f32(x + i), sx1 = vld1q_f32(x + i + 4);
+		float32x4_t sy0 = vld1q_f32(y + i), sy1 = vld1q_f32(y + i + 4);
+		float32x4_t sz0 = vld1q_f32(z + i), sz1 = vld1q_f32(z + i + 4);
+		float32x4_t neg_r0 = vnegq_f32(vld1q_f32(radius + i));
+		float32x4_t neg_r1 = vnegq_f32(vld1q_f32(radius + i + 4));
+
+		uint32x4_t inside0 = vdupq_n_u32(0xffffffff);
+		uint32x4_t inside1 = vdupq_n_u32(0xffffffff);
+		for (u32 p = 0; p < 6; p++) {
+			const vec4 *plane = &frustum->planes[p];
+			float32x4_t d0 = vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(vdupq_n_f32(plane->w), sx0, plane->x), sy0, plane->y), sz0, plane->z);
+			float32x4_t d1 = vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(vdupq_n_f32(plane->w), sx1, plane->x), sy1, plane->y), sz1, plane->z);
+			inside0 = vandq_u32(inside0, vcgeq_f32(d0, neg_r0));
+			inside1 = vandq_u32(inside1, vcgeq_f32(d1, neg_r1));
+		}
+
+		u32 lanes[8];
+		vst1q_u32(lanes, inside0);
+		vst1q_u32(lanes + 4, inside1);
+		for (u32 k = 0; k < 8; k++) {
+			visible[i + k] = lanes[k] & 1;
+			result += lanes[k] & 1;
+		}
+	}
+#endif
+
+	result += cull_spheres_scalar(frustum, x + i, y + i, z + i, radius + i, count - i, visible + i);
+	return result;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "common.h"
+#include "maths.h"
+
+// Planes as (normal, distance), normalized and pointing into the frustum, in
+// the order left, right, bottom, top, near, far
+typedef struct
+{
+	vec4 planes[6];
+} Frustum;
+
+Frustum frustum_from_view_projection(const mat4 *view_projection);
+
+// Tests the spheres given as separate x, y, z and radius arrays against the
+// frustum and writes 1 to visible for each one that intersects it, 0 otherwise.
+// Returns the number of visible spheres.
+u32 frustum_cull_spheres(const Frustum *frustum, const f32 *x, const f32 *y, const f32 *z, const f32 *radius, u32 count, u8 *visible);
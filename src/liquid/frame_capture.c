@@ -0,0 +1,403 @@
+#include "frame_capture.h"
+#include "cpu_profiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FRAME_CAPTURE_FLAGS (GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT)
+
+/* -- PNG encoding -- */
+
+static u32 crc_table[256];
+
+static void init_crc_table()
+{
+	for (u32 i = 0; i < 256; i++) {
+		u32 c = i;
+		for (u32 k = 0; k < 8; k++) {
+			c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+		}
+		crc_table[i] = c;
+	}
+}
+
+typedef struct
+{
+	FILE *file;
+	u32 crc;
+
+	// zlib stream state
+	size_t remaining;
+	u32 block_left;
+	u32 adler_a;
+	u32 adler_b;
+} PNGWriter;
+
+static void png_write(PNGWriter *png, const void *data, size_t size)
+{
+	const u8 *bytes = data;
+	u32 crc = png->crc;
+	for (size_t i = 0; i < size; i++) {
+		crc = crc_table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+	}
+	png->crc = crc;
+	fwrite(data, 1, size, png->file);
+}
+
+static void png_write_u32(PNGWriter *png, u32 value)
+{
+	u8 bytes[4] = {value >> 24, value >> 16, value >> 8, value};
+	png_write(png, bytes, 4);
+}
+
+static void png_begin_chunk(PNGWriter *png, const char *type, u32 length)
+{
+	u8 bytes[4] = {length >> 24, length >> 16, length >> 8, length};
+	fwrite(bytes, 1, 4, png->file);
+	png->crc = 0xffffffff;
+	png_write(png, type, 4);
+}
+
+static void png_end_chunk(PNGWriter *png)
+{
+	png_write_u32(png, png->crc ^ 0xffffffff);
+}
+
+// Appends to the image data as stored deflate blocks; compressing would cost
+// more time than the worker has per frame during continuous capture
+static void png_write_deflate(PNGWriter *png, const void *data, size_t size)
+{
+	const u8 *bytes = data;
+	while (size > 0) {
+		if (png->block_left == 0) {
+			u32 block = png->remaining < 65535 ? (u32) png->remaining : 65535;
+			u8 header[5] = {png->remaining == block, block, block >> 8, ~block, ~block >> 8};
+			png_write(png, header, 5);
+			png->block_left = block;
+		}
+
+		u32 n = size < png->block_left ? (u32) size : png->block_left;
+		// 5552 bytes is the most that can be summed before the sums could overflow
+		for (u32 i = 0; i < n; i += 5552) {
+			u32 end = i + 5552 < n ? i + 5552 : n;
+			for (u32 j = i; j < end; j++) {
+				png->adler_a += bytes[j];
+				png->adler_b += png->adler_a;
+			}
+			png->adler_a %= 65521;
+			png->adler_b %= 65521;
+		}
+		png_write(png, bytes, n);
+
+		bytes += n;
+		size -= n;
+		png->block_left -= n;
+		png->remaining -= n;
+	}
+}
+
+// Pixels are RGBA rows from glReadPixels, bottom to top; the PNG is RGB, top to bottom
+static bool write_png(const char *path, const u8 *pixels, u32 width, u32 height)
+{
+	FILE *file = fopen(path, "wb");
+	if (!file) {
+		return false;
+	}
+
+	PNGWriter png = {file};
+
+	const u8 signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+	fwrite(signature, 1, 8, file);
+
+	png_begin_chunk(&png, "IHDR", 13);
+	png_write_u32(&png, width);
+	png_write_u32(&png, height);
+	const u8 header[5] = {8, 2, 0, 0, 0}; // 8 bit RGB, no interlacing
+	png_write(&png, header, 5);
+	png_end_chunk(&png);
+
+	size_t row_size = 1 + 3 * (size_t) width;
+	size_t raw_size = row_size * height;
+	size_t num_blocks = raw_size ? (raw_size + 65534) / 65535 : 1;
+	png_begin_chunk(&png, "IDAT", (u32) (2 + 5 * num_blocks + raw_size + 4));
+	const u8 zlib_header[2] = {0x78, 0x01};
+	png_write(&png, zlib_header, 2);
+	png.remaining = raw_size;
+	png.adler_a = 1;
+	png.adler_b = 0;
+
+	u8 *row = malloc(row_size);
+	row[0] = 0; // No filter
+	for (u32 y = 0; y < height; y++) {
+		const u8 *src = pixels + 4 * (size_t) width * (height - 1 - y);
+		for (u32 x = 0; x < width; x++) {
+			row[1 + 3 * x + 0] = src[4 * x + 0];
+			row[1 + 3 * x + 1] = src[4 * x + 1];
+			row[1 + 3 * x + 2] = src[4 * x + 2];
+		}
+		png_write_deflate(&png, row, row_size);
+	}
+	free(row);
+
+	png_write_u32(&png, (png.adler_b << 16) | png.adler_a);
+	png_end_chunk(&png);
+
+	png_begin_chunk(&png, "IEND", 0);
+	png_end_chunk(&png);
+
+	bool result = ferror(file) == 0;
+	fclose(file);
+	return result;
+}
+
+static bool write_raw(const char *path, const u8 *pixels, u32 width, u32 height)
+{
+	FILE *file = fopen(path, "wb");
+	if (!file) {
+		return false;
+	}
+
+	size_t row_size = 4 * (size_t) width;
+	for (u32 y = 0; y < height; y++) {
+		fwrite(pixels + row_size * (height - 1 - y), 1, row_size, file);
+	}
+
+	bool result = ferror(file) == 0;
+	fclose(file);
+	return result;
+}
+
+/* -- Worker -- */
+
+static void *capture_worker_main(void *arg)
+{
+	FrameCapture *capture = arg;
+	PROFILE_THREAD_NAME("frame capture");
+
+	pthread_mutex_lock(&capture->mutex);
+	for (;;) {
+		while (capture->queue_size == 0 && !capture->quit) {
+			pthread_cond_wait(&capture->cond, &capture->mutex);
+		}
+		if (capture->queue_size == 0) {
+			break;
+		}
+		FrameCaptureSlot *slot = &capture->slots[capture->queue[capture->queue_head]];
+		capture->queue_head = (capture->queue_head + 1) % FRAME_CAPTURE_RING_SIZE;
+		capture->queue_size--;
+		pthread_mutex_unlock(&capture->mutex);
+
+		{
+			PROFILE_SCOPE("encode frame");
+			bool written = slot->request.format == FRAME_CAPTURE_PNG
+				? write_png(slot->request.path, slot->pixels, slot->width, slot->height)
+				: write_raw(slot->request.path, slot->pixels, slot->width, slot->height);
+			if (!written) {
+				ERROR("Failed to write frame capture: %s", slot->request.path);
+			}
+		}
+		if (!capture->persistent) {
+			free(slot->pixels);
+		}
+		slot->pixels = NULL;
+
+		pthread_mutex_lock(&capture->mutex);
+		slot->state = FRAME_CAPTURE_SLOT_FREE;
+		capture->captured++;
+		pthread_cond_broadcast(&capture->cond);
+	}
+	pthread_mutex_unlock(&capture->mutex);
+
+	return NULL;
+}
+
+/* -- GL thread -- */
+
+void frame_capture_init(FrameCapture *capture)
+{
+	FrameCapture empty = {};
+	*capture = empty;
+
+	capture->persistent = GLEW_ARB_buffer_storage;
+	init_crc_table();
+
+	pthread_mutex_init(&capture->mutex, NULL);
+	pthread_cond_init(&capture->cond, NULL);
+	if (pthread_create(&capture->worker, NULL, capture_worker_main, capture) != 0) {
+		FATAL("Failed to create the frame capture thread.");
+	}
+}
+
+static FrameCaptureSlotState slot_state(FrameCapture *capture, u32 index)
+{
+	pthread_mutex_lock(&capture->mutex);
+	FrameCaptureSlotState result = capture->slots[index].state;
+	pthread_mutex_unlock(&capture->mutex);
+	return result;
+}
+
+// The fence has signaled, so the pixels can be read without waiting
+static void dispatch(FrameCapture *capture, u32 index)
+{
+	FrameCaptureSlot *slot = &capture->slots[index];
+	glDeleteSync(slot->fence);
+	slot->fence = NULL;
+
+	if (capture->persistent) {
+		slot->pixels = slot->mapped;
+	} else {
+		size_t size = 4 * (size_t) slot->width * slot->height;
+		slot->pixels = malloc(size);
+		GL_CALL(glBindBuffer, GL_PIXEL_PACK_BUFFER, slot->buffer);
+		void *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+		if (mapped) {
+			memcpy(slot->pixels, mapped, size);
+			GL_CALL(glUnmapBuffer, GL_PIXEL_PACK_BUFFER);
+		} else {
+			ERROR("Failed to map a frame capture buffer.");
+			memset(slot->pixels, 0, size);
+		}
+		GL_CALL(glBindBuffer, GL_PIXEL_PACK_BUFFER, 0);
+	}
+
+	pthread_mutex_lock(&capture->mutex);
+	slot->state = FRAME_CAPTURE_SLOT_ENCODING;
+	capture->queue[(capture->queue_head + capture->queue_size) % FRAME_CAPTURE_RING_SIZE] = index;
+	capture->queue_size++;
+	pthread_cond_broadcast(&capture->cond);
+	pthread_mutex_unlock(&capture->mutex);
+}
+
+static void wait_and_dispatch(FrameCapture *capture, u32 index)
+{
+	GLsync fence = capture->slots[index].fence;
+	GLenum status;
+	do {
+		status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+	} while (status == GL_TIMEOUT_EXPIRED);
+	dispatch(capture, index);
+}
+
+void frame_capture_destroy(FrameCapture *capture)
+{
+	for (u32 i = 0; i < FRAME_CAPTURE_RING_SIZE; i++) {
+		u32 index = (capture->next + i) % FRAME_CAPTURE_RING_SIZE;
+		if (slot_state(capture, index) == FRAME_CAPTURE_SLOT_READING) {
+			wait_and_dispatch(capture, index);
+		}
+	}
+
+	// The worker drains its queue before it quits
+	pthread_mutex_lock(&capture->mutex);
+	capture->quit = true;
+	pthread_cond_broadcast(&capture->cond);
+	pthread_mutex_unlock(&capture->mutex);
+	pthread_join(capture->worker, NULL);
+	pthread_mutex_destroy(&capture->mutex);
+	pthread_cond_destroy(&capture->cond);
+
+	for (u32 i = 0; i < FRAME_CAPTURE_RING_SIZE; i++) {
+		FrameCaptureSlot *slot = &capture->slots[i];
+		if (slot->mapped) {
+			GL_CALL(glBindBuffer, GL_PIXEL_PACK_BUFFER, slot->buffer);
+			GL_CALL(glUnmapBuffer, GL_PIXEL_PACK_BUFFER);
+			GL_CALL(glBindBuffer, GL_PIXEL_PACK_BUFFER, 0);
+		}
+		if (slot->buffer) {
+			GL_CALL(glDeleteBuffers, 1, &slot->buffer);
+		}
+	}
+
+	if (capture->captured > 0) {
+		INFO("Captured %u frames, %u stalls.", capture->captured, capture->stalls);
+	}
+}
+
+void frame_capture_poll(FrameCapture *capture)
+{
+	// Oldest first; fences signal in submission order
+	for (u32 i = 0; i < FRAME_CAPTURE_RING_SIZE; i++) {
+		u32 index = (capture->next + i) % FRAME_CAPTURE_RING_SIZE;
+		if (slot_state(capture, index) != FRAME_CAPTURE_SLOT_READING) {
+			continue;
+		}
+
+		GLenum status = glClientWaitSync(capture->slots[index].fence, 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+			break;
+		}
+		dispatch(capture, index);
+	}
+}
+
+// Buffer storage is immutable, so a larger frame needs a new buffer
+static void resize_slot(FrameCapture *capture, FrameCaptureSlot *slot, size_t size)
+{
+	if (slot->mapped) {
+		GL_CALL(glBindBuffer, GL_PIXEL_PACK_BUFFER, slot->buffer);
+		GL_CALL(glUnmapBuffer, GL_PIXEL_PACK_BUFFER);
+		slot->mapped = NULL;
+	}
+	if (slot->buffer) {
+		GL_CALL(glDeleteBuffers, 1, &slot->buffer);
+	}
+
+	GL_CALL(glGenBuffers, 1, &slot->buffer);
+	GL_CALL(glBindBuffer, GL_PIXEL_PACK_BUFFER, slot->buffer);
+	if (capture->persistent) {
+		GL_CALL(glBufferStorage, GL_PIXEL_PACK_BUFFER, size, NULL, FRAME_CAPTURE_FLAGS);
+		slot->mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, FRAME_CAPTURE_FLAGS);
+		if (slot->mapped == NULL) {
+			FATAL("Failed to persistently map a frame capture buffer.");
+		}
+	} else {
+		GL_CALL(glBufferData, GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+	}
+	GL_CALL(glBindBuffer, GL_PIXEL_PACK_BUFFER, 0);
+	slot->capacity = size;
+}
+
+void frame_capture_read(FrameCapture *capture, const FrameCaptureRequest *request)
+{
+	PROFILE_FUNCTION();
+
+	u32 index = capture->next;
+	FrameCaptureSlot *slot = &capture->slots[index];
+
+	// Every slot is busy; only happens when captures outpace the GPU or the worker
+	FrameCaptureSlotState state = slot_state(capture, index);
+	if (state != FRAME_CAPTURE_SLOT_FREE) {
+		capture->stalls++;
+		if (state == FRAME_CAPTURE_SLOT_READING) {
+			wait_and_dispatch(capture, index);
+		}
+		pthread_mutex_lock(&capture->mutex);
+		while (slot->state != FRAME_CAPTURE_SLOT_FREE) {
+			pthread_cond_wait(&capture->cond, &capture->mutex);
+		}
+		pthread_mutex_unlock(&capture->mutex);
+	}
+
+	GLint viewport[4];
+	GL_CALL(glGetIntegerv, GL_VIEWPORT, viewport);
+	slot->width = viewport[2];
+	slot->height = viewport[3];
+	slot->request = *request;
+
+	size_t size = 4 * (size_t) slot->width * slot->height;
+	if (size > slot->capacity) {
+		resize_slot(capture, slot, size);
+	}
+
+	GL_CALL(glBindBuffer, GL_PIXEL_PACK_BUFFER, slot->buffer);
+	GL_CALL(glReadPixels, viewport[0], viewport[1], slot->width, slot->height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	GL_CALL(glBindBuffer, GL_PIXEL_PACK_BUFFER, 0);
+	slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	pthread_mutex_lock(&capture->mutex);
+	slot->state = FRAME_CAPTURE_SLOT_READING;
+	pthread_mutex_unlock(&capture->mutex);
+
+	capture->next = (index + 1) % FRAME_CAPTURE_RING_SIZE;
+}
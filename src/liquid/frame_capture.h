@@ -0,0 +1,81 @@
+#pragma once
+
+#include "common.h"
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include <pthread.h>
+
+#define FRAME_CAPTURE_RING_SIZE 4
+#define FRAME_CAPTURE_PATH_LENGTH 256
+
+typedef enum
+{
+	FRAME_CAPTURE_PNG,
+	FRAME_CAPTURE_RAW, // Tightly packed RGBA8 rows, top to bottom
+} FrameCaptureFormat;
+
+typedef struct
+{
+	bool requested;
+	char path[FRAME_CAPTURE_PATH_LENGTH];
+	FrameCaptureFormat format;
+} FrameCaptureRequest;
+
+typedef enum
+{
+	FRAME_CAPTURE_SLOT_FREE,
+	FRAME_CAPTURE_SLOT_READING, // glReadPixels issued, waiting for the fence
+	FRAME_CAPTURE_SLOT_ENCODING, // Owned by the worker until it is written out
+} FrameCaptureSlotState;
+
+typedef struct
+{
+	FrameCaptureSlotState state;
+	GLuint buffer;
+	size_t capacity;
+	u8 *mapped; // Persistently mapped pixels, NULL without GL_ARB_buffer_storage
+	u8 *pixels; // What the worker encodes from: mapped, or a copy made on the GL thread
+	GLsync fence;
+
+	u32 width;
+	u32 height;
+	FrameCaptureRequest request;
+} FrameCaptureSlot;
+
+// Reads frames back without stalling. glReadPixels goes into a pixel pack
+// buffer from a ring of FRAME_CAPTURE_RING_SIZE, followed by a fence; the
+// buffer is only touched again once the fence has signaled, a few frames
+// later. Encoding and writing the file happens on a worker thread.
+//
+// Slots go FREE -> READING on the GL thread, READING -> ENCODING once their
+// fence signals, and back to FREE on the worker. A capture only waits when all
+// slots are busy, which is counted in stalls.
+typedef struct
+{
+	bool persistent;
+
+	FrameCaptureSlot slots[FRAME_CAPTURE_RING_SIZE];
+	u32 next;
+
+	pthread_t worker;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	u32 queue[FRAME_CAPTURE_RING_SIZE];
+	u32 queue_head;
+	u32 queue_size;
+	bool quit;
+
+	u32 captured;
+	u32 stalls;
+} FrameCapture;
+
+void frame_capture_init(FrameCapture *capture);
+// Finishes every pending capture before returning
+void frame_capture_destroy(FrameCapture *capture);
+
+// Hands captures whose fence signaled over to the worker; call once a frame
+void frame_capture_poll(FrameCapture *capture);
+// Captures the viewport of the bound read framebuffer
+void frame_capture_read(FrameCapture *capture, const FrameCaptureRequest *request);
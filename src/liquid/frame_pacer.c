@@ -0,0 +1,127 @@
+#include "frame_pacer.h"
+#include "cpu_profiler.h"
+
+#include <math.h>
+#include <time.h>
+
+void frame_pacer_init(FramePacer *pacer, f64 target_fps, bool late_input)
+{
+	FramePacer result = {};
+	result.period = target_fps > 0.0 ? (u64) (1000000000.0 / target_fps) : 0;
+	result.late_input = late_input;
+	result.spin_threshold = FRAME_PACER_INITIAL_SPIN_NS;
+	*pacer = result;
+}
+
+// Sleeps until spin_threshold before the deadline and spins from there. An
+// oversleep raises the threshold at once, after which it slowly decays again.
+static void wait_until(FramePacer *pacer, u64 deadline)
+{
+	u64 now = cpu_profiler_now();
+	if (now + pacer->spin_threshold < deadline) {
+		u64 duration = deadline - pacer->spin_threshold - now;
+		struct timespec ts = {(time_t) (duration / 1000000000ull), (long) (duration % 1000000000ull)};
+		nanosleep(&ts, NULL);
+
+		u64 woken = cpu_profiler_now();
+		u64 overshoot = woken > now + duration ? woken - now - duration : 0;
+		u64 threshold = overshoot + overshoot / 2;
+		if (threshold > pacer->spin_threshold) {
+			pacer->spin_threshold = threshold;
+		} else {
+			pacer->spin_threshold -= (pacer->spin_threshold - threshold) / 16;
+		}
+		now = woken;
+	}
+
+	while (now < deadline) {
+		now = cpu_profiler_now();
+	}
+}
+
+// Frames stay on a fixed grid, so that waking up a little late does not add up.
+// Only after falling behind by a whole period does the grid start over.
+static u64 next_on_schedule(const FramePacer *pacer, u64 scheduled, u64 now)
+{
+	if (scheduled == 0 || now >= scheduled + pacer->period) {
+		return now + pacer->period;
+	}
+	return scheduled + pacer->period;
+}
+
+void frame_pacer_wait(FramePacer *pacer)
+{
+	PROFILE_FUNCTION();
+
+	u64 deadline = 0;
+	if (pacer->period && pacer->late_input && pacer->next_end) {
+		// Leaves just enough time for the work to end on schedule
+		u64 lead = pacer->work_estimate + FRAME_PACER_LATE_MARGIN_NS;
+		deadline = pacer->next_end - (lead < pacer->period ? lead : pacer->period);
+	} else if (pacer->period && !pacer->late_input) {
+		deadline = pacer->next_begin;
+	}
+	if (deadline) {
+		wait_until(pacer, deadline);
+	}
+
+	u64 now = cpu_profiler_now();
+	pacer->frame_begin = now;
+	pacer->next_begin = next_on_schedule(pacer, pacer->next_begin, now);
+}
+
+void frame_pacer_end_frame(FramePacer *pacer)
+{
+	u64 now = cpu_profiler_now();
+
+	// Follows a longer frame at once and a shorter one slowly, so a single fast
+	// frame does not make the next wait end too late
+	u64 work = now - pacer->frame_begin;
+	if (work > pacer->work_estimate) {
+		pacer->work_estimate = work;
+	} else {
+		pacer->work_estimate -= (pacer->work_estimate - work) / 16;
+	}
+	pacer->next_end = next_on_schedule(pacer, pacer->next_end, now);
+
+	if (pacer->last_end) {
+		pacer->intervals[pacer->next_interval] = (f64) (now - pacer->last_end) / 1000000.0;
+		pacer->next_interval = (pacer->next_interval + 1) % FRAME_PACER_HISTORY;
+		if (pacer->num_intervals < FRAME_PACER_HISTORY) {
+			pacer->num_intervals++;
+		}
+	}
+	pacer->last_end = now;
+}
+
+// Without a target frame rate, deviations are measured from the mean interval
+FramePacerStats frame_pacer_stats(const FramePacer *pacer)
+{
+	FramePacerStats result = {};
+	result.num_frames = pacer->num_intervals;
+	result.work_estimate = (f64) pacer->work_estimate / 1000000.0;
+	if (pacer->num_intervals == 0) {
+		return result;
+	}
+
+	f64 sum = 0.0;
+	for (u32 i = 0; i < pacer->num_intervals; i++) {
+		sum += pacer->intervals[i];
+	}
+	result.mean_interval = sum / pacer->num_intervals;
+
+	f64 target = pacer->period ? (f64) pacer->period / 1000000.0 : result.mean_interval;
+	f64 variance = 0.0;
+	for (u32 i = 0; i < pacer->num_intervals; i++) {
+		f64 difference = pacer->intervals[i] - result.mean_interval;
+		variance += difference * difference;
+
+		f64 deviation = fabs(pacer->intervals[i] - target);
+		if (deviation > result.max_deviation) {
+			result.max_deviation = deviation;
+		}
+	}
+	result.jitter = sqrt(variance / pacer->num_intervals);
+
+	return result;
+}
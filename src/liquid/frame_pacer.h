@@ -0,0 +1,50 @@
+#pragma once
+
+#include "common.h"
+
+#define FRAME_PACER_HISTORY 256
+// Sleeps are trusted to wake up no later than this before the deadline at first
+#define FRAME_PACER_INITIAL_SPIN_NS 2000000ull
+// Room left between the estimated end of the frame's work and its deadline
+#define FRAME_PACER_LATE_MARGIN_NS 1000000ull
+
+// Measured over the last FRAME_PACER_HISTORY frames, in milliseconds
+typedef struct
+{
+	f64 mean_interval;
+	f64 jitter; // Standard deviation of the interval between frames
+	f64 max_deviation; // Largest distance of one interval from the target
+	f64 work_estimate; // Time between frame_pacer_wait and frame_pacer_end_frame
+	u32 num_frames;
+} FramePacerStats;
+
+// Limits the frame rate with a wait that sleeps while the deadline is far and
+// spins for the rest, so the frame starts on time without sleeping through it.
+// How much to spin follows the sleep overshoot the pacer has observed.
+//
+// Call frame_pacer_wait right before sampling input and frame_pacer_end_frame
+// after graphics_end_frame. With late_input, the wait does not end at the start
+// of the frame slot but as late as the recent frames' work allows, so input is
+// sampled as close to the frame being shown as possible.
+typedef struct
+{
+	u64 period; // 0 does not wait, but still measures
+	bool late_input;
+
+	u64 spin_threshold;
+	u64 work_estimate;
+	u64 frame_begin;
+	u64 last_end;
+	// The schedule: where the next frame should begin, or with late_input end
+	u64 next_begin;
+	u64 next_end;
+
+	f64 intervals[FRAME_PACER_HISTORY];
+	u32 num_intervals;
+	u32 next_interval;
+} FramePacer;
+
+void frame_pacer_init(FramePacer *pacer, f64 target_fps, bool late_input);
+void frame_pacer_wait(FramePacer *pacer);
+void frame_pacer_end_frame(FramePacer *pacer);
+FramePacerStats frame_pacer_stats(const FramePacer *pacer);
@@ -0,0 +1,199 @@
+#include "gl_state.h"
+
+#define GL_STATE_UNKNOWN 0xffffffff
+
+enum
+{
+	CAP_DEPTH_TEST,
+	CAP_DEPTH_CLAMP,
+	CAP_CULL_FACE,
+	CAP_BLEND,
+	CAP_SCISSOR_TEST,
+	CAP_COUNT
+};
+
+typedef struct
+{
+	GLuint program;
+	u32 active_unit;
+	GLuint textures[GL_STATE_MAX_TEXTURE_UNITS];
+	GLuint vao;
+	GLuint element_buffer;
+	u32 caps[CAP_COUNT];
+	u32 depth_mask;
+
+	GLStateStats stats;
+} GLState;
+
+static _Thread_local GLState gl_state; // A thread has at most one current context
+
+static i32 cap_index(GLenum cap)
+{
+	switch (cap) {
+		case GL_DEPTH_TEST: return CAP_DEPTH_TEST;
+		case GL_DEPTH_CLAMP: return CAP_DEPTH_CLAMP;
+		case GL_CULL_FACE: return CAP_CULL_FACE;
+		case GL_BLEND: return CAP_BLEND;
+		case GL_SCISSOR_TEST: return CAP_SCISSOR_TEST;
+	}
+	return -1;
+}
+
+void gl_state_invalidate()
+{
+	gl_state.program = GL_STATE_UNKNOWN;
+	gl_state.active_unit = GL_STATE_UNKNOWN;
+	for (u32 i = 0; i < GL_STATE_MAX_TEXTURE_UNITS; i++) {
+		gl_state.textures[i] = GL_STATE_UNKNOWN;
+	}
+	gl_state.vao = GL_STATE_UNKNOWN;
+	gl_state.element_buffer = GL_STATE_UNKNOWN;
+	for (u32 i = 0; i < CAP_COUNT; i++) {
+		gl_state.caps[i] = GL_STATE_UNKNOWN;
+	}
+	gl_state.depth_mask = GL_STATE_UNKNOWN;
+}
+
+void gl_state_use_program(GLuint program)
+{
+	if (gl_state.program == program) {
+		gl_state.stats.skipped++;
+		return;
+	}
+
+	GL_CALL(glUseProgram, program);
+	gl_state.program = program;
+	gl_state.stats.issued++;
+}
+
+void gl_state_active_texture(u32 unit)
+{
+	if (gl_state.active_unit == unit) {
+		gl_state.stats.skipped++;
+		return;
+	}
+
+	GL_CALL(glActiveTexture, GL_TEXTURE0 + unit);
+	gl_state.active_unit = unit;
+	gl_state.stats.issued++;
+}
+
+void gl_state_bind_texture(u32 unit, GLuint texture)
+{
+	ASSERT(unit < GL_STATE_MAX_TEXTURE_UNITS, "Texture unit %d out of range.", unit);
+
+	if (gl_state.textures[unit] == texture) {
+		gl_state.stats.skipped++;
+		return;
+	}
+
+	gl_state_active_texture(unit);
+	GL_CALL(glBindTexture, GL_TEXTURE_2D, texture);
+	gl_state.textures[unit] = texture;
+	gl_state.stats.issued++;
+}
+
+void gl_state_bind_vertex_array(GLuint vao)
+{
+	if (gl_state.vao == vao) {
+		gl_state.stats.skipped++;
+		return;
+	}
+
+	GL_CALL(glBindVertexArray, vao);
+	gl_state.vao = vao;
+	gl_state.stats.issued++;
+
+	// The element buffer binding is part of the vertex array object
+	gl_state.element_buffer = GL_STATE_UNKNOWN;
+}
+
+void gl_state_bind_element_buffer(GLuint buffer)
+{
+	if (gl_state.element_buffer == buffer) {
+		gl_state.stats.skipped++;
+		return;
+	}
+
+	GL_CALL(glBindBuffer, GL_ELEMENT_ARRAY_BUFFER, buffer);
+	gl_state.element_buffer = buffer;
+	gl_state.stats.issued++;
+}
+
+void gl_state_enable(GLenum cap)
+{
+	i32 index = cap_index(cap);
+	if (index >= 0 && gl_state.caps[index] == GL_TRUE) {
+		gl_state.stats.skipped++;
+		return;
+	}
+
+	GL_CALL(glEnable, cap);
+	if (index >= 0) {
+		gl_state.caps[index] = GL_TRUE;
+	}
+	gl_state.stats.issued++;
+}
+
+void gl_state_disable(GLenum cap)
+{
+	i32 index = cap_index(cap);
+	if (index >= 0 && gl_state.caps[index] == GL_FALSE) {
+		gl_state.stats.skipped++;
+		return;
+	}
+
+	GL_CALL(glDisable, cap);
+	if (index >= 0) {
+		gl_state.caps[index] = GL_FALSE;
+	}
+	gl_state.stats.issued++;
+}
+
+void gl_state_depth_mask(bool write)
+{
+	u32 mask = write ? GL_TRUE : GL_FALSE;
+	if (gl_state.depth_mask == mask) {
+		gl_state.stats.skipped++;
+		return;
+	}
+
+	GL_CALL(glDepthMask, mask);
+	gl_state.depth_mask = mask;
+	gl_state.stats.issued++;
+}
+
+void gl_state_forget_program(GLuint program)
+{
+	if (gl_state.program == program) {
+		gl_state.program = GL_STATE_UNKNOWN;
+	}
+}
+
+void gl_state_forget_texture(GLuint texture)
+{
+	for (u32 i = 0; i < GL_STATE_MAX_TEXTURE_UNITS; i++) {
+		if (gl_state.textures[i] == texture) {
+			gl_state.textures[i] = GL_STATE_UNKNOWN;
+		}
+	}
+}
+
+void gl_state_forget_vertex_array(GLuint vao)
+{
+	if (gl_state.vao == vao) {
+		gl_state.vao = GL_STATE_UNKNOWN;
+		gl_state.element_buffer = GL_STATE_UNKNOWN;
+	}
+}
+
+GLStateStats gl_state_stats()
+{
+	return gl_state.stats;
+}
+
+void gl_state_reset_stats()
+{
+	gl_state.stats.issued = 0;
+	gl_state.stats.skipped = 0;
+}
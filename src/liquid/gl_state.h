@@ -0,0 +1,38 @@
+#pragma once
+
+#include "common.h"
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#define GL_STATE_MAX_TEXTURE_UNITS 32
+
+typedef struct
+{
+	u32 issued;
+	u32 skipped;
+} GLStateStats;
+
+// Shadow copy of the GL state the renderer touches most. Every bind goes through
+// these functions, which only call into the driver when the value changes.
+// The shadow state describes the calling thread's current context only; call
+// gl_state_invalidate after switching contexts or after code outside liquid
+// changed the bindings.
+void gl_state_invalidate();
+
+void gl_state_use_program(GLuint program);
+void gl_state_active_texture(u32 unit);
+void gl_state_bind_texture(u32 unit, GLuint texture);
+void gl_state_bind_vertex_array(GLuint vao);
+void gl_state_bind_element_buffer(GLuint buffer);
+void gl_state_enable(GLenum cap);
+void gl_state_disable(GLenum cap);
+void gl_state_depth_mask(bool write);
+
+// Deleted names may be reused by GL, so the cache has to forget them
+void gl_state_forget_program(GLuint program);
+void gl_state_forget_texture(GLuint texture);
+void gl_state_forget_vertex_array(GLuint vao);
+
+GLStateStats gl_state_stats();
+void gl_state_reset_stats();
@@ -0,0 +1,168 @@
+#include "gpu_profiler.h"
+
+#include <string.h>
+
+void gpu_profiler_init(GPUProfiler *profiler)
+{
+	GPUProfiler empty = {};
+	*profiler = empty;
+
+	profiler->enabled = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+	if (!profiler->enabled) {
+		WARN("Timer queries are not supported, GPU profiling is disabled.");
+		return;
+	}
+
+	for (u32 i = 0; i < GPU_PROFILER_FRAMES; i++) {
+		for (u32 j = 0; j < GPU_PROFILER_MAX_SCOPES; j++) {
+			GL_CALL(glGenQueries, 2, profiler->scopes[i][j].queries);
+		}
+	}
+}
+
+void gpu_profiler_destroy(GPUProfiler *profiler)
+{
+	gpu_profiler_close_csv(profiler);
+
+	if (profiler->enabled) {
+		for (u32 i = 0; i < GPU_PROFILER_FRAMES; i++) {
+			for (u32 j = 0; j < GPU_PROFILER_MAX_SCOPES; j++) {
+				GL_CALL(glDeleteQueries, 2, profiler->scopes[i][j].queries);
+			}
+		}
+	}
+	profiler->enabled = false;
+}
+
+// Queries complete in order. The frame scope is ended last, so once its end is
+// available all of the frame's queries are.
+static void read_back(GPUProfiler *profiler, u32 slot)
+{
+	u32 count = profiler->num_scopes[slot];
+	profiler->num_scopes[slot] = 0;
+	if (count == 0) {
+		return;
+	}
+
+	GPUScope *scopes = profiler->scopes[slot];
+	GLint available = 0;
+	GL_CALL(glGetQueryObjectiv, scopes[0].queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available) {
+		profiler->dropped_frames++;
+		return;
+	}
+
+	for (u32 i = 0; i < count; i++) {
+		GLuint64 begin, end;
+		GL_CALL(glGetQueryObjectui64v, scopes[i].queries[0], GL_QUERY_RESULT, &begin);
+		GL_CALL(glGetQueryObjectui64v, scopes[i].queries[1], GL_QUERY_RESULT, &end);
+
+		GPUScopeResult *result = &profiler->results[i];
+		memcpy(result->name, scopes[i].name, GPU_PROFILER_NAME_LENGTH);
+		result->depth = scopes[i].depth;
+		result->milliseconds = (f64) (end - begin) / 1000000.0;
+
+		if (profiler->csv) {
+			fprintf(profiler->csv, "%llu,%s,%u,%.6f\n", (unsigned long long) profiler->frame_numbers[slot], result->name, result->depth, result->milliseconds);
+		}
+	}
+	profiler->num_results = count;
+	profiler->results_frame = profiler->frame_numbers[slot];
+}
+
+void gpu_profiler_begin_frame(GPUProfiler *profiler)
+{
+	if (!profiler->enabled) {
+		return;
+	}
+
+	profiler->slot = profiler->frame % GPU_PROFILER_FRAMES;
+	read_back(profiler, profiler->slot);
+	profiler->frame_numbers[profiler->slot] = profiler->frame;
+	profiler->depth = 0;
+
+	gpu_profiler_begin(profiler, "frame");
+}
+
+void gpu_profiler_end_frame(GPUProfiler *profiler)
+{
+	if (!profiler->enabled) {
+		return;
+	}
+
+	while (profiler->depth > 0) {
+		gpu_profiler_end(profiler);
+	}
+	profiler->frame++;
+}
+
+void gpu_profiler_begin(GPUProfiler *profiler, const char *name)
+{
+	if (!profiler->enabled) {
+		return;
+	}
+
+	u32 slot = profiler->slot;
+	if (profiler->num_scopes[slot] == GPU_PROFILER_MAX_SCOPES || profiler->depth == GPU_PROFILER_MAX_DEPTH) {
+		// Still balance the matching gpu_profiler_end
+		if (profiler->depth < GPU_PROFILER_MAX_DEPTH) {
+			profiler->stack[profiler->depth] = GPU_PROFILER_MAX_SCOPES;
+		}
+		profiler->depth++;
+		return;
+	}
+
+	u32 index = profiler->num_scopes[slot]++;
+	GPUScope *scope = &profiler->scopes[slot][index];
+	strncpy(scope->name, name, GPU_PROFILER_NAME_LENGTH - 1);
+	scope->name[GPU_PROFILER_NAME_LENGTH - 1] = 0;
+	scope->depth = profiler->depth;
+	GL_CALL(glQueryCounter, scope->queries[0], GL_TIMESTAMP);
+
+	profiler->stack[profiler->depth++] = index;
+}
+
+void gpu_profiler_end(GPUProfiler *profiler)
+{
+	if (!profiler->enabled || profiler->depth == 0) {
+		return;
+	}
+
+	profiler->depth--;
+	if (profiler->depth >= GPU_PROFILER_MAX_DEPTH || profiler->stack[profiler->depth] == GPU_PROFILER_MAX_SCOPES) {
+		return;
+	}
+
+	GPUScope *scope = &profiler->scopes[profiler->slot][profiler->stack[profiler->depth]];
+	GL_CALL(glQueryCounter, scope->queries[1], GL_TIMESTAMP);
+}
+
+const GPUScopeResult *gpu_profiler_results(const GPUProfiler *profiler, u32 *count, u64 *frame)
+{
+	*count = profiler->num_results;
+	if (frame) {
+		*frame = profiler->results_frame;
+	}
+	return profiler->results;
+}
+
+bool gpu_profiler_open_csv(GPUProfiler *profiler, const char *path)
+{
+	gpu_profiler_close_csv(profiler);
+
+	profiler->csv = fopen(path, "w");
+	if (!profiler->csv) {
+		ERROR("Failed to open GPU profile: %s", path);
+		return false;
+	}
+	fprintf(profiler->csv, "frame,scope,depth,milliseconds\n");
+	return true;
+}
+
+void gpu_profiler_close_csv(GPUProfiler *profiler)
+{
+	if (profiler->csv) {
+		fclose(profiler->csv);
+		profiler->csv = NULL;
+	}
+}
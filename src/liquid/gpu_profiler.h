@@ -0,0 +1,69 @@
+#pragma once
+
+#include "common.h"
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include <stdio.h>
+
+#define GPU_PROFILER_FRAMES 4
+#define GPU_PROFILER_MAX_SCOPES 128
+#define GPU_PROFILER_MAX_DEPTH 16
+#define GPU_PROFILER_NAME_LENGTH 32
+
+typedef struct
+{
+	char name[GPU_PROFILER_NAME_LENGTH];
+	u32 depth;
+	f64 milliseconds;
+} GPUScopeResult;
+
+typedef struct
+{
+	char name[GPU_PROFILER_NAME_LENGTH];
+	u32 depth;
+	GLuint queries[2];
+} GPUScope;
+
+// Measures named, nestable scopes with GL_TIMESTAMP queries. Each frame records
+// into one of GPU_PROFILER_FRAMES slots, and a slot is read back when it comes
+// around again. A slot whose results are not available by then is dropped
+// instead of waited for, so profiling never stalls the pipeline.
+typedef struct
+{
+	bool enabled;
+
+	GPUScope scopes[GPU_PROFILER_FRAMES][GPU_PROFILER_MAX_SCOPES];
+	u32 num_scopes[GPU_PROFILER_FRAMES];
+	u64 frame_numbers[GPU_PROFILER_FRAMES];
+	u32 slot;
+	u64 frame;
+
+	u32 stack[GPU_PROFILER_MAX_DEPTH];
+	u32 depth;
+
+	// Most recent frame that was read back
+	GPUScopeResult results[GPU_PROFILER_MAX_SCOPES];
+	u32 num_results;
+	u64 results_frame;
+	u32 dropped_frames;
+
+	FILE *csv;
+} GPUProfiler;
+
+void gpu_profiler_init(GPUProfiler *profiler);
+void gpu_profiler_destroy(GPUProfiler *profiler);
+
+void gpu_profiler_begin_frame(GPUProfiler *profiler);
+void gpu_profiler_end_frame(GPUProfiler *profiler);
+
+// name is copied, and truncated to GPU_PROFILER_NAME_LENGTH - 1 characters
+void gpu_profiler_begin(GPUProfiler *profiler, const char *name);
+void gpu_profiler_end(GPUProfiler *profiler);
+
+const GPUScopeResult *gpu_profiler_results(const GPUProfiler *profiler, u32 *count, u64 *frame);
+
+// Appends a "frame,scope,depth,milliseconds" row for every scope read back from now on
+bool gpu_profiler_open_csv(GPUProfiler *profiler, const char *path);
+void gpu_profiler_close_csv(GPUProfiler *profiler);
@@ -1,5 +1,9 @@
 #include "graphics.h"
 #include "shader.h"
+#include "gl_state.h"
+#include "cpu_profiler.h"
+#include "command_capture.h"
+#include "resource_registry.h"
 
 #define STB_TRUETYPE_IMPLEMENTATION
 #include "stb/stb_truetype.h"
@@ -9,106 +13,208 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+// Default key layout, most significant first: layer, shader, texture, mesh, depth
+static const SortKeySlot default_sort_key_layout[] = {
+	{SORT_KEY_LAYER, 5},
+	{SORT_KEY_SHADER, 9},
+	{SORT_KEY_TEXTURE, 14},
+	{SORT_KEY_MESH, 12},
+	{SORT_KEY_DEPTH, 24}
+};
+
+// Shader field of the sort key. Program names differ between the threads that
+// record, since every drawing thread loads its own default shaders, so keys use
+// these stable indices instead.
+typedef enum
+{
+	SORT_SHADER_SPRITE = 1,
+	SORT_SHADER_BASIC,
+	SORT_SHADER_TEXT
+} SortShader;
+
+static const LayerConfig default_layer = {LAYER_SORT_STATE, true, true, false};
 
 typedef struct
 {
-	Transform transform;
-	mat4 projection;
-	Texture texture;
-	vec4 color;
-} DrawTriangleCommandData;
+	Uniform transformation;
+	Uniform view_projection;
+	Uniform color;
+	Uniform diffuse;
+} DrawUniforms;
+
+// Every thread drawing has its own default shaders, see shader_load_defaults
+static _Thread_local DrawUniforms basic_uniforms;
+static _Thread_local DrawUniforms basic_instanced_uniforms;
+static _Thread_local DrawUniforms basic_indirect_uniforms;
+
+// The window whose context is current on this thread; immediate draws go there
+static _Thread_local GraphicsWindow *context_window;
 
 typedef struct
 {
-	Transform transform;
-	mat4 projection;
-	Texture texture;
-	vec4 color;
-} DrawRectCommandData;
+	u32 count;
+	u32 instance_count;
+	u32 first_index;
+	i32 base_vertex;
+	u32 base_instance;
+} DrawElementsIndirectCommand;
+
+static DrawUniforms resolve_draw_uniforms(Shader shader)
+{
+	DrawUniforms result;
+	result.transformation = shader_get_uniform(shader, "transformation");
+	result.view_projection = shader_get_uniform(shader, "view_projection");
+	result.color = shader_get_uniform(shader, "color");
+	result.diffuse = shader_get_uniform(shader, "diffuse");
+	return result;
+}
 
-typedef struct
+static void load_thread_shaders()
 {
-	Mesh mesh;
-	Transform transform;
-	mat4 projection;
-	Texture texture;
-	vec4 color;
-} DrawMeshCommandData;
+	shader_load_defaults();
+	basic_uniforms = resolve_draw_uniforms(shader_get_basic());
+	basic_instanced_uniforms = resolve_draw_uniforms(shader_get_basic_instanced());
+	basic_indirect_uniforms = resolve_draw_uniforms(shader_get_basic_indirect());
+}
 
-typedef struct
+// Runs with the window's context current
+static void init_window(GraphicsData *graphics_data, GraphicsWindow *graphics_window)
 {
-	Transform transform;
-	mat4 projection;
-	Font font;
-} DrawTextCommandData;
-
-static void init_primitives(GraphicsData *graphics_data)
-{
-	static const GLfloat triangle_vertices[] = {
-		-1.0f, -1.0f, 0.0f,
-		 1.0f, -1.0f, 0.0f,
-		 0.0f,  1.0f, 0.0f
-	};
-
-	static const GLfloat triangle_uvs[] = {
-		0.0f, 0.0f,
-		0.5f, 1.0f,
-		1.0f, 0.0f
-	};
-
-	static const GLfloat rect_vertices[] = {
-		-1.0f, -1.0f, 0.0f,
-		-1.0f,  1.0f, 0.0f,
-		 1.0f, -1.0f, 0.0f,
-		 1.0f,  1.0f, 0.0f
-	};
-
-	static const GLfloat rect_uvs[] = {
-		0.0f, 0.0f,
-		0.0f, 1.0f,
-		1.0f, 0.0f,
-		1.0f, 1.0f,
-	};
-
-	GLuint vbo;
-
-	GL_CALL(glGenVertexArrays, 1, &graphics_data->primitive_triangle_vao);
-	GL_CALL(glBindVertexArray, graphics_data->primitive_triangle_vao);
-	GL_CALL(glGenBuffers, 1, &vbo);
-	GL_CALL(glBindBuffer, GL_ARRAY_BUFFER, vbo);
-	GL_CALL(glBufferData, GL_ARRAY_BUFFER, sizeof(triangle_vertices) + sizeof(triangle_uvs), triangle_vertices, GL_STATIC_DRAW);
-	GL_CALL(glBufferSubData, GL_ARRAY_BUFFER, sizeof(triangle_vertices), sizeof(triangle_uvs), triangle_uvs);
-	GL_CALL(glEnableVertexAttribArray, 0);
-	GL_CALL(glEnableVertexAttribArray, 1);
-	GL_CALL(glVertexAttribPointer, 0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
-	GL_CALL(glVertexAttribPointer, 1, 2, GL_FLOAT, GL_FALSE, 0, (const GLvoid *) sizeof(triangle_vertices));
-	GL_CALL(glBindVertexArray, 0);
-	GL_CALL(glDeleteBuffers, 1, &vbo);
-
-	GL_CALL(glGenVertexArrays, 1, &graphics_data->primitive_rect_vao);
-	GL_CALL(glBindVertexArray, graphics_data->primitive_rect_vao);
-	GL_CALL(glGenBuffers, 1, &vbo);
-	GL_CALL(glBindBuffer, GL_ARRAY_BUFFER, vbo);
-	GL_CALL(glBufferData, GL_ARRAY_BUFFER, sizeof(rect_vertices) + sizeof(rect_uvs), rect_vertices, GL_STATIC_DRAW);
-	GL_CALL(glBufferSubData, GL_ARRAY_BUFFER, sizeof(rect_vertices), sizeof(rect_uvs), rect_uvs);
-	GL_CALL(glEnableVertexAttribArray, 0);
-	GL_CALL(glEnableVertexAttribArray, 1);
-	GL_CALL(glVertexAttribPointer, 0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
-	GL_CALL(glVertexAttribPointer, 1, 2, GL_FLOAT, GL_FALSE, 0, (const GLvoid *) sizeof(rect_vertices));
-	GL_CALL(glBindVertexArray, 0);
-	GL_CALL(glDeleteBuffers, 1, &vbo);
+	graphics_window->graphics_data = graphics_data;
+
+	stream_buffer_init(&graphics_window->stream, STREAM_BUFFER_DEFAULT_SIZE);
+	sprite_batch_init(&graphics_window->sprite_batch, &graphics_window->stream);
+	gpu_profiler_init(&graphics_window->gpu_profiler);
+	frame_capture_init(&graphics_window->frame_capture);
+
+	if (graphics_data->use_indirect) {
+		GL_CALL(glGenBuffers, 1, &graphics_window->draw_id_buffer);
+	}
+
+	for (u32 i = 0; i < 2; i++) {
+		FramePacket *packet = &graphics_window->packets[i];
+		packet->num_buckets = 1;
+		pthread_mutex_init(&packet->overflow_mutex, NULL);
+		packet->buckets[GRAPHICS_MAX_COMMAND_BUCKETS - 1].lock = &packet->overflow_mutex;
+	}
+	graphics_window->recording = &graphics_window->packets[0];
+
+	gl_state_enable(GL_DEPTH_TEST);
+	gl_state_enable(GL_DEPTH_CLAMP);
+	gl_state_enable(GL_CULL_FACE);
+	glCullFace(GL_BACK);
+}
+
+static void destroy_window(GraphicsWindow *graphics_window)
+{
+	frame_capture_destroy(&graphics_window->frame_capture);
+	sprite_batch_destroy(&graphics_window->sprite_batch);
+	stream_buffer_destroy(&graphics_window->stream);
+	gpu_profiler_destroy(&graphics_window->gpu_profiler);
+	if (graphics_window->draw_id_buffer) {
+		GL_CALL(glDeleteBuffers, 1, &graphics_window->draw_id_buffer);
+	}
+	if (graphics_window->mesh_vao) {
+		gl_state_forget_vertex_array(graphics_window->mesh_vao);
+		GL_CALL(glDeleteVertexArrays, 1, &graphics_window->mesh_vao);
+	}
+
+	for (u32 i = 0; i < 2; i++) {
+		FramePacket *packet = &graphics_window->packets[i];
+		for (u32 j = 0; j < GRAPHICS_MAX_COMMAND_BUCKETS; j++) {
+			CommandBucket *bucket = &packet->buckets[j];
+			arena_destroy(&bucket->arena);
+			free(bucket->entries);
+			free(bucket->scratch);
+		}
+		pthread_mutex_destroy(&packet->overflow_mutex);
+	}
+	free(graphics_window->queue);
+}
+
+// Runs once the first context is current
+static bool init_graphics(GraphicsData *graphics_data)
+{
+	glewExperimental = GL_TRUE;
+	i32 error = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+	// GLEW built for GLX looks for a GLX display after loading the GL functions,
+	// which an EGL context does not have
+	if (error == GLEW_ERROR_NO_GLX_DISPLAY && graphics_data->headless)
+	{
+		error = GLEW_OK;
+	}
+#endif
+	if (error)
+	{
+		FATAL("Failed to initialize OpenGL (error code: %d).", error);
+		return false;
+	}
+	INFO("Initialized OpenGL.");
+	INFO("Graphics Card Vendor: %s", glGetString(GL_VENDOR));
+	INFO("Graphics Card: %s", glGetString(GL_RENDERER));
+	INFO("OpenGL version: %s", glGetString(GL_VERSION));
+	INFO("GLSL version: %s", glGetString(GL_SHADING_LANGUAGE_VERSION));
+
+	load_thread_shaders();
+	graphics_set_sort_key_layout(graphics_data, default_sort_key_layout, sizeof(default_sort_key_layout) / sizeof(SortKeySlot));
+	for (u32 i = 0; i < GRAPHICS_MAX_LAYERS; i++) {
+		graphics_data->layers[i] = default_layer;
+	}
+
+	graphics_data->use_indirect = shader_get_basic_indirect() != 0;
+	if (graphics_data->use_indirect) {
+		GL_CALL(glGetIntegerv, GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &graphics_data->storage_alignment);
+		INFO("Using multi-draw indirect for meshes.");
+	}
+
+	graphics_data->initialized = true;
+	return true;
+}
+
+static void make_context_current(GraphicsData *graphics_data, GraphicsWindow *graphics_window);
+
+// Any event may change what a window shows, so with idle frame skipping the
+// next frame is drawn even if it records the same commands
+static void note_event(GLFWwindow *handle)
+{
+	GraphicsWindow *graphics_window = glfwGetWindowUserPointer(handle);
+	graphics_window->events++;
+}
+
+static void key_event(GLFWwindow *handle, i32 key, i32 scancode, i32 action, i32 mods) { note_event(handle); }
+static void button_event(GLFWwindow *handle, i32 button, i32 action, i32 mods) { note_event(handle); }
+static void position_event(GLFWwindow *handle, f64 x, f64 y) { note_event(handle); }
+static void size_event(GLFWwindow *handle, i32 width, i32 height) { note_event(handle); }
+static void state_event(GLFWwindow *handle, i32 state) { note_event(handle); }
+static void refresh_event(GLFWwindow *handle) { note_event(handle); }
+
+static void set_event_callbacks(GLFWwindow *handle)
+{
+	glfwSetKeyCallback(handle, key_event);
+	glfwSetMouseButtonCallback(handle, button_event);
+	glfwSetCursorPosCallback(handle, position_event);
+	glfwSetScrollCallback(handle, position_event);
+	glfwSetCursorEnterCallback(handle, state_event);
+	glfwSetFramebufferSizeCallback(handle, size_event);
+	glfwSetWindowFocusCallback(handle, state_event);
+	glfwSetWindowRefreshCallback(handle, refresh_event);
 }
 
+// Windows should be created before any render thread is started. All contexts
+// share objects with each other, so resources loaded once work in every window.
 Window graphics_create_window(GraphicsData *graphics_data, u32 width, u32 height, const char *title)
 {
-	GLFWwindow *result;
+	if (graphics_data->headless)
+	{
+		ERROR("Windows can not be created next to a headless context.");
+		return -1;
+	}
 
 	if (!graphics_data->initialized)
 	{
-		for (u32 i = 0; i < GRAPHICS_MAX_WINDOWS; i++) {
-			graphics_data->indices[i] = i;
-		}
-
 		if (!glfwInit())
 		{
 			ERROR("Failed to initialize GLFW.");
@@ -117,7 +223,17 @@ Window graphics_create_window(GraphicsData *graphics_data, u32 width, u32 height
 		INFO("Initialized GLFW.");
 	}
 
-	if (graphics_data->num_windows == GRAPHICS_MAX_WINDOWS)
+	Window result = -1;
+	GLFWwindow *share = NULL;
+	for (u32 i = 0; i < GRAPHICS_MAX_WINDOWS; i++) {
+		if (graphics_data->windows[i]) {
+			share = graphics_data->windows[i]->handle;
+		} else if (result == -1) {
+			result = i;
+		}
+	}
+
+	if (result == -1)
 	{
 		ERROR("Maximum number of windows surpassed.");
 		return -1;
@@ -129,73 +245,143 @@ Window graphics_create_window(GraphicsData *graphics_data, u32 width, u32 height
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 
-	result = glfwCreateWindow(width, height, title, NULL, NULL);
-	if (!result)
+	GLFWwindow *handle = glfwCreateWindow(width, height, title, NULL, share);
+	if (!handle)
 	{
-		glfwTerminate();
+		if (graphics_data->num_windows == 0) {
+			glfwTerminate();
+		}
 		return -1;
 	}
 
-	glfwMakeContextCurrent(result);
+	GraphicsWindow *graphics_window = calloc(1, sizeof(GraphicsWindow));
+	graphics_window->handle = handle;
+	glfwSetWindowUserPointer(handle, graphics_window);
+	set_event_callbacks(handle);
+	make_context_current(graphics_data, graphics_window);
 
-	if (!graphics_data->initialized)
+	if (!graphics_data->initialized && !init_graphics(graphics_data))
 	{
-		glewExperimental = GL_TRUE;
-		i32 error = glewInit();
-		if (error)
-		{
-			FATAL("Failed to initialize OpenGL (error code: %d).", error);
-			return -1;
+		context_window = NULL;
+		glfwDestroyWindow(handle);
+		free(graphics_window);
+		if (graphics_data->num_windows == 0) {
+			glfwTerminate();
 		}
-		INFO("Initialized OpenGL.");
-		INFO("Graphics Card Vendor: %s", glGetString(GL_VENDOR));
-		INFO("Graphics Card: %s", glGetString(GL_RENDERER));
-		INFO("OpenGL version: %s", glGetString(GL_VERSION));
-		INFO("GLSL version: %s", glGetString(GL_SHADING_LANGUAGE_VERSION));
+		return -1;
+	}
+	init_window(graphics_data, graphics_window);
+
+	graphics_data->windows[result] = graphics_window;
+	graphics_data->num_windows++;
+	if (!graphics_data->recording_window) {
+		graphics_data->recording_window = graphics_window;
+	}
 
-		shader_load_defaults();
-		init_primitives(graphics_data);
+	INFO("Created window. Title: %s, width: %d, height: %d", title, width, height);
 
-		glEnable(GL_DEPTH_TEST);
-		glEnable(GL_DEPTH_CLAMP);
-		glEnable(GL_CULL_FACE);
-		glCullFace(GL_BACK);
+	return result;
+}
 
-		graphics_data->initialized = true;
+#ifdef GRAPHICS_HEADLESS
+// Sets the graphics up without GLFW or a window system. The returned window
+// stands for the offscreen framebuffer and works with the frame and draw
+// functions like any other; it never asks to be closed.
+Window graphics_create_headless(GraphicsData *graphics_data, u32 width, u32 height)
+{
+	if (graphics_data->initialized)
+	{
+		ERROR("A headless context has to be the only one.");
+		return -1;
 	}
 
-	graphics_data->windows[graphics_data->indices[graphics_data->num_windows]] = result;
-	graphics_data->num_windows++;
+	if (!headless_context_create(&graphics_data->headless_context, width, height))
+	{
+		return -1;
+	}
+	graphics_data->headless = true;
+	gl_state_invalidate();
 
-	// TEMP
-	graphics_data->queue = malloc(1024 * sizeof(DrawCommand));
-	graphics_data->queue_capacity = 1024;
+	if (!init_graphics(graphics_data))
+	{
+		headless_context_destroy(&graphics_data->headless_context);
+		graphics_data->headless = false;
+		return -1;
+	}
+	headless_context_create_framebuffer(&graphics_data->headless_context);
 
-	INFO("Created window. Title: %s, width: %d, height: %d", title, width, height);
+	GraphicsWindow *graphics_window = calloc(1, sizeof(GraphicsWindow));
+	make_context_current(graphics_data, graphics_window);
+	init_window(graphics_data, graphics_window);
 
-	return graphics_data->num_windows - 1;
+	graphics_data->windows[0] = graphics_window;
+	graphics_data->num_windows = 1;
+	graphics_data->recording_window = graphics_window;
+
+	INFO("Created headless context. Width: %d, height: %d", width, height);
+
+	return 0;
 }
+#endif
 
 void graphics_destroy_window(GraphicsData *graphics_data, Window *window)
 {
-	GLFWwindow **temp = &graphics_data->windows[graphics_data->indices[*window]]; 
-	glfwDestroyWindow(*temp);
-	*temp = graphics_data->windows[graphics_data->indices[graphics_data->num_windows - 1]];
-	graphics_data->indices[graphics_data->num_windows - 1] = graphics_data->indices[*window];
+	GraphicsWindow *graphics_window = graphics_data->windows[*window];
+	graphics_stop_render_thread(graphics_data, *window);
+
+	// Pending captures need the context to still exist
+	bool last = graphics_data->num_windows == 1;
+	if (last) {
+		command_capture_end();
+	}
+	make_context_current(graphics_data, graphics_window);
+	destroy_window(graphics_window);
+
+	// Shared objects go with the last context
+	if (last) {
+		mesh_buffer_destroy();
+		shader_destroy_defaults();
+	}
+
+	if (graphics_window->handle) {
+		glfwDestroyWindow(graphics_window->handle);
+	}
+	context_window = NULL;
+	free(graphics_window);
+
+	graphics_data->windows[*window] = NULL;
 	graphics_data->num_windows--;
+	if (graphics_data->recording_window == graphics_window) {
+		graphics_data->recording_window = NULL;
+		for (u32 i = 0; i < GRAPHICS_MAX_WINDOWS && !graphics_data->recording_window; i++) {
+			graphics_data->recording_window = graphics_data->windows[i];
+		}
+	}
 	INFO("Closed window: %d", *window);
 	*window = -1;
 
 	if (graphics_data->num_windows == 0)
 	{
 		INFO("All windows are closed.");
-		shader_destroy_defaults();
+#ifdef GRAPHICS_HEADLESS
+		if (graphics_data->headless) {
+			headless_context_destroy(&graphics_data->headless_context);
+			graphics_data->headless = false;
+			INFO("Destroyed headless context.");
+			return;
+		}
+#endif
 		glfwTerminate();
 		INFO("Terminated GLFW.");
 	}
 }
 
 void *graphics_get_window_ptr(GraphicsData *graphics_data, Window window) {
+	return graphics_data->windows[window]->handle;
+}
+
+GraphicsWindow *graphics_get_window(GraphicsData *graphics_data, Window window)
+{
 	return graphics_data->windows[window];
 }
 
@@ -206,15 +392,127 @@ bool graphics_terminated(GraphicsData *graphics_data)
 
 bool window_should_close(GraphicsData *graphics_data, Window *window)
 {
-	return glfwWindowShouldClose(graphics_data->windows[graphics_data->indices[*window]]);
+	GLFWwindow *glfw_window = graphics_data->windows[*window]->handle;
+	return glfw_window && glfwWindowShouldClose(glfw_window);
+}
+
+static void make_context_current(GraphicsData *graphics_data, GraphicsWindow *graphics_window)
+{
+	context_window = graphics_window;
+#ifdef GRAPHICS_HEADLESS
+	if (graphics_data->headless) {
+		if (!headless_context_is_current(&graphics_data->headless_context)) {
+			headless_context_make_current(&graphics_data->headless_context);
+			gl_state_invalidate();
+		}
+		return;
+	}
+#endif
+	if (glfwGetCurrentContext() != graphics_window->handle) {
+		glfwMakeContextCurrent(graphics_window->handle);
+		gl_state_invalidate();
+	}
+}
+
+static void release_context(GraphicsData *graphics_data)
+{
+	context_window = NULL;
+#ifdef GRAPHICS_HEADLESS
+	if (graphics_data->headless) {
+		headless_context_release();
+		return;
+	}
+#endif
+	glfwMakeContextCurrent(NULL);
+}
+
+static void begin_gl_frame(GraphicsData *graphics_data, GraphicsWindow *graphics_window)
+{
+	gl_state_reset_stats();
+	graphics_window->culled_meshes = 0;
+	graphics_window->draw_calls = 0;
+	graphics_window->sprite_batch.draw_calls = 0;
+	stream_buffer_begin_frame(&graphics_window->stream);
+	gpu_profiler_begin_frame(&graphics_window->gpu_profiler);
+#ifdef GRAPHICS_HEADLESS
+	if (graphics_data->headless) {
+		headless_context_bind_framebuffer(&graphics_data->headless_context);
+	}
+#endif
+	GL_CALL(glClear, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+static FrameStats collect_frame_stats(GraphicsWindow *graphics_window)
+{
+	GLStateStats state = gl_state_stats();
+
+	FrameStats result;
+	result.draw_calls = graphics_window->draw_calls + graphics_window->sprite_batch.draw_calls;
+	result.state_changes = state.issued;
+	result.redundant_state_changes = state.skipped;
+	result.culled_meshes = graphics_window->culled_meshes;
+	return result;
+}
+
+static void end_gl_frame(GraphicsWindow *graphics_window, const FrameCaptureRequest *capture, bool present)
+{
+	PROFILE_FUNCTION();
+
+	sprite_batch_flush(&graphics_window->sprite_batch);
+	frame_capture_poll(&graphics_window->frame_capture);
+	if (capture->requested) {
+		frame_capture_read(&graphics_window->frame_capture, capture);
+	}
+	gpu_profiler_end_frame(&graphics_window->gpu_profiler);
+	stream_buffer_end_frame(&graphics_window->stream);
+	if (graphics_window->handle && present) {
+		glfwSwapBuffers(graphics_window->handle);
+	}
+}
+
+static void finish_packet(GraphicsData *graphics_data, FramePacket *packet);
+static void render_packet(GraphicsWindow *graphics_window, FramePacket *packet);
+static void reset_packet(FramePacket *packet, u32 num_buckets);
+static u32 packet_num_buckets(const FramePacket *packet);
+
+// The queue of an idle frame was not drawn at flush time; drawing it now
+// presents the frame after all
+static void cancel_idle_frame(GraphicsWindow *graphics_window)
+{
+	if (!graphics_window->idle) {
+		return;
+	}
+
+	graphics_window->idle = false;
+	if (!graphics_window->render_thread_running) {
+		make_context_current(graphics_window->graphics_data, graphics_window);
+		render_packet(graphics_window, graphics_window->recording);
+	}
 }
 
+static bool all_windows_idle(GraphicsData *graphics_data)
+{
+	for (u32 i = 0; i < GRAPHICS_MAX_WINDOWS; i++) {
+		if (graphics_data->windows[i] && !graphics_data->windows[i]->idle) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Commands submitted from here on are recorded for window. With a render thread
+// running, the frame is cleared and swapped over there.
 void graphics_begin_frame(GraphicsData *graphics_data, Window *window)
 {
 	if (*window != -1)
 	{
-		glfwMakeContextCurrent(graphics_data->windows[graphics_data->indices[*window]]);
-		GL_CALL(glClear, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		GraphicsWindow *graphics_window = graphics_data->windows[*window];
+		graphics_data->recording_window = graphics_window;
+		graphics_window->drawn_immediately = false;
+		if (!graphics_window->render_thread_running) {
+			make_context_current(graphics_data, graphics_window);
+			begin_gl_frame(graphics_data, graphics_window);
+		}
 	}
 }
 
@@ -222,8 +520,55 @@ void graphics_end_frame(GraphicsData *graphics_data, Window *window)
 {
 	if (*window != -1)
 	{
-		glfwMakeContextCurrent(graphics_data->windows[graphics_data->indices[*window]]);
-		glfwSwapBuffers(graphics_data->windows[graphics_data->indices[*window]]);
+		GraphicsWindow *graphics_window = graphics_data->windows[*window];
+
+		if (command_capture_active()) {
+			command_capture_write_end_frame();
+		}
+
+		// A capture requested after the queue was flushed still needs the frame
+		if (graphics_window->capture_request.requested) {
+			cancel_idle_frame(graphics_window);
+		}
+
+		if (graphics_window->idle) {
+			// Nothing is handed over or swapped, the last presented frame stays on screen
+			FramePacket *packet = graphics_window->recording;
+			reset_packet(packet, packet_num_buckets(packet));
+			if (!graphics_window->render_thread_running) {
+				FrameCaptureRequest no_capture = {};
+				make_context_current(graphics_data, graphics_window);
+				end_gl_frame(graphics_window, &no_capture, false);
+			}
+
+			if (!graphics_data->headless && all_windows_idle(graphics_data)) {
+				PROFILE_SCOPE("idle wait");
+				glfwWaitEventsTimeout(graphics_data->idle_timeout);
+			}
+		} else if (graphics_window->render_thread_running) {
+			// Waits for the render thread to finish the previous frame, whose packet
+			// is then free to record the next one into
+			PROFILE_SCOPE("frame handoff");
+			FramePacket *packet = graphics_window->recording;
+			finish_packet(graphics_data, packet);
+			packet->capture = graphics_window->capture_request;
+			graphics_window->capture_request.requested = false;
+
+			pthread_mutex_lock(&graphics_window->render_mutex);
+			while (graphics_window->render_packet != NULL) {
+				pthread_cond_wait(&graphics_window->render_cond, &graphics_window->render_mutex);
+			}
+			graphics_window->render_packet = packet;
+			pthread_cond_broadcast(&graphics_window->render_cond);
+			pthread_mutex_unlock(&graphics_window->render_mutex);
+
+			graphics_window->recording = packet == &graphics_window->packets[0] ? &graphics_window->packets[1] : &graphics_window->packets[0];
+		} else {
+			make_context_current(graphics_data, graphics_window);
+			end_gl_frame(graphics_window, &graphics_window->capture_request, true);
+			graphics_window->capture_request.requested = false;
+			graphics_window->frame_stats = collect_frame_stats(graphics_window);
+		}
 
 		if (window_should_close(graphics_data, window)) {
 			graphics_destroy_window(graphics_data, window);
@@ -231,186 +576,1163 @@ void graphics_end_frame(GraphicsData *graphics_data, Window *window)
 	}
 }
 
+void graphics_capture_frame_async(GraphicsData *graphics_data, const char *path, FrameCaptureFormat format)
+{
+	if (!graphics_data->recording_window) {
+		return;
+	}
+
+	FrameCaptureRequest *request = &graphics_data->recording_window->capture_request;
+	request->requested = true;
+	snprintf(request->path, FRAME_CAPTURE_PATH_LENGTH, "%s", path);
+	request->format = format;
+}
+
+void graphics_set_idle_skipping(GraphicsData *graphics_data, bool enabled, f64 timeout)
+{
+	graphics_data->skip_idle_frames = enabled;
+	graphics_data->idle_timeout = timeout;
+	for (u32 i = 0; i < GRAPHICS_MAX_WINDOWS; i++) {
+		if (graphics_data->windows[i]) {
+			graphics_data->windows[i]->presented = false;
+			graphics_data->windows[i]->idle = false;
+		}
+	}
+}
+
+// With a render thread this is the frame drawn last, which lags recording by one
+FrameStats graphics_frame_stats(GraphicsData *graphics_data, Window window)
+{
+	GraphicsWindow *graphics_window = graphics_data->windows[window];
+	if (!graphics_window->render_thread_running) {
+		return graphics_window->frame_stats;
+	}
+
+	pthread_mutex_lock(&graphics_window->render_mutex);
+	FrameStats result = graphics_window->frame_stats;
+	pthread_mutex_unlock(&graphics_window->render_mutex);
+	return result;
+}
+
+static void *render_thread_main(void *arg)
+{
+	GraphicsWindow *graphics_window = arg;
+	GraphicsData *graphics_data = graphics_window->graphics_data;
+	PROFILE_THREAD_NAME("render");
+	make_context_current(graphics_data, graphics_window);
+	load_thread_shaders();
+
+	pthread_mutex_lock(&graphics_window->render_mutex);
+	for (;;) {
+		while (graphics_window->render_packet == NULL && !graphics_window->render_thread_quit) {
+			pthread_cond_wait(&graphics_window->render_cond, &graphics_window->render_mutex);
+		}
+		if (graphics_window->render_packet == NULL) {
+			break;
+		}
+		FramePacket *packet = graphics_window->render_packet;
+		pthread_mutex_unlock(&graphics_window->render_mutex);
+
+		begin_gl_frame(graphics_data, graphics_window);
+		render_packet(graphics_window, packet);
+		end_gl_frame(graphics_window, &packet->capture, true);
+		FrameStats stats = collect_frame_stats(graphics_window);
+
+		pthread_mutex_lock(&graphics_window->render_mutex);
+		graphics_window->frame_stats = stats;
+		graphics_window->render_packet = NULL;
+		pthread_cond_broadcast(&graphics_window->render_cond);
+	}
+	pthread_mutex_unlock(&graphics_window->render_mutex);
+
+	shader_destroy_defaults();
+	release_context(graphics_data);
+	return NULL;
+}
+
+// Moves all GL work for window to a thread of its own, so that a blocking swap
+// no longer holds up the calling thread. From then on the calling thread only
+// records: graphics_sort_and_flush_queue culls and sorts, and graphics_end_frame
+// hands the frame packet over. Every window can have its own render thread, so
+// the swaps of several windows wait in parallel. Resources have to be loaded,
+// and immediate draw functions used, before this or after graphics_stop_render_thread.
+void graphics_start_render_thread(GraphicsData *graphics_data, Window window)
+{
+	GraphicsWindow *graphics_window = graphics_data->windows[window];
+	if (graphics_window->render_thread_running) {
+		return;
+	}
+
+	graphics_window->render_packet = NULL;
+	graphics_window->render_thread_quit = false;
+	pthread_mutex_init(&graphics_window->render_mutex, NULL);
+	pthread_cond_init(&graphics_window->render_cond, NULL);
+
+	// A context can only be current on one thread
+	if (context_window == graphics_window) {
+		release_context(graphics_data);
+	}
+
+	if (pthread_create(&graphics_window->render_thread, NULL, render_thread_main, graphics_window) != 0) {
+		WARN("Failed to start the render thread, drawing on the calling thread.");
+		pthread_cond_destroy(&graphics_window->render_cond);
+		pthread_mutex_destroy(&graphics_window->render_mutex);
+		make_context_current(graphics_data, graphics_window);
+		return;
+	}
+
+	graphics_window->render_thread_running = true;
+	INFO("Started render thread for window %d.", window);
+}
+
+// Draws the frame that was handed over last, then takes the context back
+void graphics_stop_render_thread(GraphicsData *graphics_data, Window window)
+{
+	GraphicsWindow *graphics_window = graphics_data->windows[window];
+	if (!graphics_window->render_thread_running) {
+		return;
+	}
+
+	pthread_mutex_lock(&graphics_window->render_mutex);
+	graphics_window->render_thread_quit = true;
+	pthread_cond_broadcast(&graphics_window->render_cond);
+	pthread_mutex_unlock(&graphics_window->render_mutex);
+
+	pthread_join(graphics_window->render_thread, NULL);
+	pthread_cond_destroy(&graphics_window->render_cond);
+	pthread_mutex_destroy(&graphics_window->render_mutex);
+	graphics_window->render_thread_running = false;
+
+	make_context_current(graphics_data, graphics_window);
+	INFO("Stopped render thread for window %d.", window);
+}
+
 void graphics_hide_cursor(GraphicsData *graphics_data, Window window)
 {
-	glfwSetInputMode(graphics_data->windows[graphics_data->indices[window]], GLFW_CURSOR, GLFW_CURSOR_HIDDEN);
+	if (graphics_data->headless) {
+		return;
+	}
+	glfwSetInputMode(graphics_data->windows[window]->handle, GLFW_CURSOR, GLFW_CURSOR_HIDDEN);
 }
 
 void graphics_disable_cursor(GraphicsData *graphics_data, Window window)
 {
-	glfwSetInputMode(graphics_data->windows[graphics_data->indices[window]], GLFW_CURSOR, GLFW_CURSOR_DISABLED);	
+	if (graphics_data->headless) {
+		return;
+	}
+	glfwSetInputMode(graphics_data->windows[window]->handle, GLFW_CURSOR, GLFW_CURSOR_DISABLED);	
 }
 
 void graphics_show_cursor(GraphicsData *graphics_data, Window window)
 {
-	glfwSetInputMode(graphics_data->windows[graphics_data->indices[window]], GLFW_CURSOR, GLFW_CURSOR_NORMAL);
+	if (graphics_data->headless) {
+		return;
+	}
+	glfwSetInputMode(graphics_data->windows[window]->handle, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
+}
+
+void graphics_set_sort_key_layout(GraphicsData *graphics_data, const SortKeySlot *slots, u32 num_slots)
+{
+	u32 total_bits = 0;
+	for (u32 i = 0; i < num_slots; i++) {
+		total_bits += slots[i].bits;
+	}
+
+	if (total_bits > 64) {
+		ERROR("Sort key layout needs %d bits, only 64 are available.", total_bits);
+		return;
+	}
+
+	// Fields missing from the layout get zero bits and never influence the order
+	SortKeyLayout result = {};
+	u32 shift = 64;
+	for (u32 i = 0; i < num_slots; i++) {
+		shift -= slots[i].bits;
+		result.shift[slots[i].field] = shift;
+		result.bits[slots[i].field] = slots[i].bits;
+	}
+
+	graphics_data->sort_key_layout = result;
+}
+
+void graphics_set_layer(GraphicsData *graphics_data, u32 layer, const LayerConfig *config)
+{
+	if (layer >= GRAPHICS_MAX_LAYERS) {
+		ERROR("Layer %d does not exist (maximum: %d).", layer, GRAPHICS_MAX_LAYERS - 1);
+		return;
+	}
+
+	LayerConfig *current = &graphics_data->layers[layer];
+	if (current->sort == config->sort && current->depth_test == config->depth_test
+		&& current->depth_write == config->depth_write && current->blend == config->blend) {
+		return;
+	}
+	*current = *config;
+	if (command_capture_active()) {
+		command_capture_write_layers(graphics_data->layers, GRAPHICS_MAX_LAYERS);
+	}
+
+	// Layer state is not hashed, so no window may repeat its last presented frame
+	for (u32 i = 0; i < GRAPHICS_MAX_WINDOWS; i++) {
+		if (graphics_data->windows[i]) {
+			graphics_data->windows[i]->presented = false;
+		}
+	}
+}
+
+static u64 sort_key_pack(const SortKeyLayout *layout, SortKeyField field, u64 value)
+{
+	u8 bits = layout->bits[field];
+	if (bits == 0) {
+		return 0;
+	}
+
+	u64 mask = bits == 64 ? ~0ull : (1ull << bits) - 1;
+	return (value & mask) << layout->shift[field];
+}
+
+static u64 sort_key_quantize_depth(u8 bits, const Transform *transform, const mat4 *parent, mat4 view_projection)
+{
+	if (bits == 0) {
+		return 0;
+	}
+
+	mat4 transformation = mat4_transformation(transform);
+	if (parent) {
+		transformation = mat4_mul(transformation, *parent);
+	}
+	vec4 origin = {{transformation.M[12], transformation.M[13], transformation.M[14], 1.0f}};
+	vec4 clip = mat4_mul_vec4(view_projection, origin);
+
+	f32 depth = clip.w > 0.0f ? 0.5f * (clip.z / clip.w) + 0.5f : 1.0f;
+	if (depth < 0.0f) depth = 0.0f;
+	if (depth > 1.0f) depth = 1.0f;
+
+	u64 max_value = bits == 64 ? ~0ull : (1ull << bits) - 1;
+	return (u64) ((f64) depth * (f64) max_value);
+}
+
+// The layer stays in its slot of the key layout. Depth sorted layers use all bits
+// below it for depth, up to 32; layers in submission order leave them zero, since
+// the sorts are stable and the merge breaks ties by bucket.
+static u64 generate_sort_key(GraphicsData *graphics_data, const DrawCommand *cmd)
+{
+	const SortKeyLayout *layout = &graphics_data->sort_key_layout;
+	LayerSortPolicy policy = graphics_data->layers[cmd->layer].sort;
+	u64 layer = sort_key_pack(layout, SORT_KEY_LAYER, cmd->layer);
+	if (policy == LAYER_SORT_SUBMISSION) {
+		return layer;
+	}
+
+	u64 shader = 0, texture = 0, mesh = 0;
+	const Transform *transform = NULL;
+	const mat4 *parent = NULL;
+	mat4 projection;
+	if (cmd->type == DRAW_TRIANGLE) {
+		DrawTriangleCommandData *data = (DrawTriangleCommandData *) cmd->data;
+		shader = SORT_SHADER_SPRITE;
+		texture = data->texture.id;
+		transform = &data->transform;
+		projection = data->projection;
+	} else if (cmd->type == DRAW_RECT) {
+		DrawRectCommandData *data = (DrawRectCommandData *) cmd->data;
+		shader = SORT_SHADER_SPRITE;
+		texture = data->texture.id;
+		transform = &data->transform;
+		projection = data->projection;
+	} else if (cmd->type == DRAW_MESH) {
+		DrawMeshCommandData *data = (DrawMeshCommandData *) cmd->data;
+		shader = SORT_SHADER_BASIC;
+		texture = data->texture.id;
+		mesh = data->mesh.id;
+		transform = &data->transform;
+		parent = data->has_parent ? &data->parent : NULL;
+		projection = data->projection;
+	} else if (cmd->type == DRAW_TEXT) {
+		DrawTextCommandData *data = (DrawTextCommandData *) cmd->data;
+		shader = SORT_SHADER_TEXT;
+		texture = data->font.texture.id;
+		transform = &data->transform;
+		projection = data->projection;
+	}
+	if (transform == NULL) {
+		return layer;
+	}
+
+	if (policy == LAYER_SORT_FRONT_TO_BACK || policy == LAYER_SORT_BACK_TO_FRONT) {
+		u8 below = layout->bits[SORT_KEY_LAYER] ? layout->shift[SORT_KEY_LAYER] : 64;
+		u8 bits = below < 32 ? below : 32;
+		u64 depth = sort_key_quantize_depth(bits, transform, parent, projection);
+		if (policy == LAYER_SORT_BACK_TO_FRONT) {
+			depth = (1ull << bits) - 1 - depth;
+		}
+		return layer | depth << (below - bits);
+	}
+
+	u64 depth = sort_key_quantize_depth(layout->bits[SORT_KEY_DEPTH], transform, parent, projection);
+	return layer
+		 | sort_key_pack(layout, SORT_KEY_SHADER, shader)
+		 | sort_key_pack(layout, SORT_KEY_TEXTURE, texture)
+		 | sort_key_pack(layout, SORT_KEY_MESH, mesh)
+		 | sort_key_pack(layout, SORT_KEY_DEPTH, depth);
+}
+
+static size_t command_payload_size(const DrawCommand *cmd)
+{
+	switch (cmd->type) {
+		case DRAW_TRIANGLE: return sizeof(DrawTriangleCommandData);
+		case DRAW_RECT: return sizeof(DrawRectCommandData);
+		case DRAW_MESH: return sizeof(DrawMeshCommandData);
+		case DRAW_TEXT: return sizeof(DrawTextCommandData) + strlen(((DrawTextCommandData *) cmd->data)->text) + 1;
+	}
+	FATAL("Unknown draw command type: %d", cmd->type);
+	return 0;
+}
+
+// Copies the command and its payload into the bucket's arena, so the caller's
+// data only has to live until this call returns.
+static void bucket_submit(GraphicsData *graphics_data, CommandBucket *bucket, DrawCommand *cmd)
+{
+	size_t payload_size = command_payload_size(cmd);
+	size_t header_size = (sizeof(DrawCommand) + ARENA_DEFAULT_ALIGNMENT - 1) & ~(size_t) (ARENA_DEFAULT_ALIGNMENT - 1);
+
+	DrawCommand *stored = arena_push(&bucket->arena, header_size + payload_size, ARENA_DEFAULT_ALIGNMENT);
+	*stored = *cmd;
+	stored->data = (u8 *) stored + header_size;
+	if (stored->layer >= GRAPHICS_MAX_LAYERS) {
+		stored->layer = GRAPHICS_MAX_LAYERS - 1;
+	}
+
+	if (cmd->type == DRAW_TEXT) {
+		DrawTextCommandData *data = (DrawTextCommandData *) stored->data;
+		*data = *(DrawTextCommandData *) cmd->data;
+		char *text = (char *) (data + 1);
+		strcpy(text, data->text);
+		data->text = text;
+	} else {
+		memcpy(stored->data, cmd->data, payload_size);
+	}
+
+	stored->key = generate_sort_key(graphics_data, stored);
+
+	if (bucket->size == bucket->capacity) {
+		bucket->capacity = bucket->capacity ? 2 * bucket->capacity : 1024;
+		bucket->entries = realloc(bucket->entries, bucket->capacity * sizeof(SortEntry));
+		bucket->scratch = realloc(bucket->scratch, bucket->capacity * sizeof(SortEntry));
+	}
+
+	bucket->entries[bucket->size].key = stored->key;
+	bucket->entries[bucket->size].cmd = stored;
+	bucket->size += 1;
+	bucket->finished = false;
+}
+
+void graphics_bucket_submit(GraphicsData *graphics_data, CommandBucket *bucket, DrawCommand *cmd)
+{
+	if (bucket->lock) {
+		pthread_mutex_lock(bucket->lock);
+		bucket_submit(graphics_data, bucket, cmd);
+		pthread_mutex_unlock(bucket->lock);
+	} else {
+		bucket_submit(graphics_data, bucket, cmd);
+	}
 }
 
 void graphics_submit_call(GraphicsData *graphics_data, DrawCommand *cmd)
 {
-	// @TODO: implement queue type
-	graphics_data->queue[graphics_data->queue_size] = *cmd;
-	graphics_data->queue_size += 1;
+	graphics_bucket_submit(graphics_data, &graphics_data->recording_window->recording->buckets[0], cmd);
+}
+
+// Can be called from any thread. The bucket belongs to the window being recorded
+// and stays valid until the next flush. Once the buckets run out, every further
+// thread gets the last one, which is locked on each submit and only ended when
+// the queue is flushed.
+CommandBucket *graphics_begin_bucket(GraphicsData *graphics_data)
+{
+	FramePacket *packet = graphics_data->recording_window->recording;
+	u32 index = __atomic_fetch_add(&packet->num_buckets, 1, __ATOMIC_RELAXED);
+	if (index == GRAPHICS_MAX_COMMAND_BUCKETS) {
+		ERROR("Too many command buckets (maximum: %d), the last one is shared.", GRAPHICS_MAX_COMMAND_BUCKETS);
+	}
+	if (index >= GRAPHICS_MAX_COMMAND_BUCKETS) {
+		index = GRAPHICS_MAX_COMMAND_BUCKETS - 1;
+	}
+	return &packet->buckets[index];
+}
+
+static void draw_triangle(GraphicsWindow *graphics_window, const Transform *transform, mat4 view_projection, const Texture *texture, vec4 color);
+static void draw_rect(GraphicsWindow *graphics_window, const Transform *transform, mat4 view_projection, const Texture *texture, vec4 color);
+static void draw_mesh(GraphicsWindow *graphics_window, Mesh mesh, mat4 transformation, mat4 view_projection, const Texture *texture, vec4 color);
+
+static mat4 mesh_command_transformation(const DrawMeshCommandData *data)
+{
+	mat4 transformation = mat4_transformation(&data->transform);
+	return data->has_parent ? mat4_mul(transformation, data->parent) : transformation;
 }
+static void draw_text(GraphicsWindow *graphics_window, const char *text, Font font, const Transform *transform, mat4 view_projection);
 
-static void exexute_draw_command(GraphicsData *graphics_data, DrawCommand cmd)
+static void exexute_draw_command(GraphicsWindow *graphics_window, const DrawCommand *cmd)
 {
-	if (cmd.type == DRAW_TRIANGLE) {
-		DrawTriangleCommandData *data = (DrawTriangleCommandData *) cmd.data;
-		graphics_draw_triangle(graphics_data, &data->transform, data->projection, &data->texture, data->color);
-	} else if (cmd.type == DRAW_RECT) {
-		DrawRectCommandData *data = (DrawRectCommandData *) cmd.data;
-		graphics_draw_rect(graphics_data, &data->transform, data->projection, &data->texture, data->color);
-	} else if (cmd.type == DRAW_MESH) {
-		DrawMeshCommandData *data = (DrawMeshCommandData *) cmd.data;
-		graphics_draw_mesh(graphics_data, data->mesh, &data->transform, data->projection, &data->texture, data->color);
+	if (cmd->type == DRAW_TRIANGLE) {
+		DrawTriangleCommandData *data = (DrawTriangleCommandData *) cmd->data;
+		draw_triangle(graphics_window, &data->transform, data->projection, &data->texture, data->color);
+	} else if (cmd->type == DRAW_RECT) {
+		DrawRectCommandData *data = (DrawRectCommandData *) cmd->data;
+		draw_rect(graphics_window, &data->transform, data->projection, &data->texture, data->color);
+	} else if (cmd->type == DRAW_MESH) {
+		DrawMeshCommandData *data = (DrawMeshCommandData *) cmd->data;
+		draw_mesh(graphics_window, data->mesh, mesh_command_transformation(data), data->projection, &data->texture, data->color);
+	} else if (cmd->type == DRAW_TEXT) {
+		DrawTextCommandData *data = (DrawTextCommandData *) cmd->data;
+		draw_text(graphics_window, data->text, data->font, &data->transform, data->projection);
 	} else {
-		FATAL("Unknown draw command type: %d", cmd.type);
+		FATAL("Unknown draw command type: %d", cmd->type);
 	}
 }
 
-void graphics_sort_and_flush_queue(GraphicsData *graphics_data)
+// Mesh commands that can go into one multi-draw: same texture and camera. All
+// meshes live in the shared mesh buffer, so the vertex array always matches.
+static bool mesh_commands_share_state(const DrawCommand *a, const DrawCommand *b)
 {
-	// @TODO: key generation and sorting
+	if (b->type != DRAW_MESH || a->layer != b->layer) {
+		return false;
+	}
 
-	// Flushing
-	for (u32 i = 0; i < graphics_data->queue_size; i++) {
-		exexute_draw_command(graphics_data, graphics_data->queue[i]);
+	DrawMeshCommandData *data_a = (DrawMeshCommandData *) a->data;
+	DrawMeshCommandData *data_b = (DrawMeshCommandData *) b->data;
+	return data_a->texture.id == data_b->texture.id
+		&& memcmp(&data_a->projection, &data_b->projection, sizeof(mat4)) == 0;
+}
+
+// Mesh commands that can go into one instanced draw: additionally the same mesh
+static bool mesh_commands_compatible(const DrawCommand *a, const DrawCommand *b)
+{
+	if (!mesh_commands_share_state(a, b)) {
+		return false;
 	}
 
-	graphics_data->queue_size = 0;
+	DrawMeshCommandData *data_a = (DrawMeshCommandData *) a->data;
+	DrawMeshCommandData *data_b = (DrawMeshCommandData *) b->data;
+	return data_a->mesh.id == data_b->mesh.id;
 }
 
-void graphics_draw_triangle(GraphicsData *graphics_data, const Transform *transform, mat4 view_projection, const Texture *texture, vec4 color)
+static void bind_mesh_vertex_array(GraphicsWindow *graphics_window)
 {
-	shader_bind(shader_get_basic());
+	if (graphics_window->mesh_vao == 0) {
+		GL_CALL(glGenVertexArrays, 1, &graphics_window->mesh_vao);
+	}
+
+	u32 generation = mesh_buffer_generation();
+	if (graphics_window->mesh_vao_generation != generation) {
+		mesh_buffer_setup_vertex_array(graphics_window->mesh_vao);
+		graphics_window->mesh_vao_generation = generation;
+	} else {
+		gl_state_bind_vertex_array(graphics_window->mesh_vao);
+	}
+}
+
+// Instances are written straight into the stream buffer. The sprite batch may
+// hold the stream's only open allocation, so it is flushed first.
+static MeshInstance *begin_instances(GraphicsWindow *graphics_window, u32 count, StreamAllocation *allocation)
+{
+	sprite_batch_flush(&graphics_window->sprite_batch);
+	*allocation = stream_buffer_alloc(&graphics_window->stream, count * sizeof(MeshInstance), sizeof(vec4));
+	return allocation->ptr;
+}
+
+static void draw_mesh_instances(GraphicsWindow *graphics_window, Mesh mesh, StreamAllocation *allocation, mat4 view_projection, const Texture *texture)
+{
+	u32 count = allocation->size / sizeof(MeshInstance);
+	stream_buffer_commit(&graphics_window->stream, allocation, allocation->size);
+
+	shader_bind(shader_get_basic_instanced());
 	texture_bind(texture);
 
-	GLint loc_transformation = glGetUniformLocation(shader_get_basic(), "view_projection");
-	GLint loc_view_projection = glGetUniformLocation(shader_get_basic(), "transformation");
-	GLint loc_color = glGetUniformLocation(shader_get_basic(), "color");
-	GLint loc_diffuse = glGetUniformLocation(shader_get_basic(), "diffuse");
+	shader_set_mat4(basic_instanced_uniforms.view_projection, &view_projection);
+	shader_set_int(basic_instanced_uniforms.diffuse, 0);
+
+	// The instance attributes live in the mesh buffer's vertex array next to the vertex data
+	bind_mesh_vertex_array(graphics_window);
+	GL_CALL(glBindBuffer, GL_ARRAY_BUFFER, graphics_window->stream.buffer);
+	for (u32 i = 0; i < 4; i++) {
+		GL_CALL(glEnableVertexAttribArray, 3 + i);
+		GL_CALL(glVertexAttribPointer, 3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(MeshInstance), (const GLvoid *) (allocation->offset + i * sizeof(vec4)));
+		GL_CALL(glVertexAttribDivisor, 3 + i, 1);
+	}
+	GL_CALL(glEnableVertexAttribArray, 7);
+	GL_CALL(glVertexAttribPointer, 7, 4, GL_FLOAT, GL_FALSE, sizeof(MeshInstance), (const GLvoid *) (allocation->offset + offsetof(MeshInstance, color)));
+	GL_CALL(glVertexAttribDivisor, 7, 1);
+
+	const MeshSlot *slot = mesh_buffer_slot(mesh);
+	gl_state_bind_element_buffer(mesh_buffer_ibo());
+	GL_CALL(glDrawElementsInstancedBaseVertex, GL_TRIANGLES, mesh.num_indices, GL_UNSIGNED_INT, (const GLvoid *) (slot->first_index * sizeof(u32)), count, slot->base_vertex);
+	graphics_window->draw_calls++;
+}
 
-	GL_CALL(glUniformMatrix4fv, loc_transformation, 1, GL_FALSE, mat4_transformation(transform).M);
-	GL_CALL(glUniformMatrix4fv, loc_view_projection, 1, GL_FALSE, view_projection.M);
-	GL_CALL(glUniform4f, loc_color, color.r, color.g, color.b, color.a);
-	GL_CALL(glUniform1i, loc_diffuse, 0);
+// Draws a bucket of mesh commands with one glMultiDrawElementsIndirect. The
+// transformation and color of every draw go into a storage buffer; each indirect
+// command's base instance selects its entry through the draw_id attribute,
+// which reads 0, 1, 2, ... from draw_id_buffer with a divisor of one.
+static void draw_meshes_indirect(GraphicsWindow *graphics_window, const SortEntry *entries, u32 count)
+{
+	sprite_batch_flush(&graphics_window->sprite_batch);
+
+	if (count > graphics_window->draw_id_capacity) {
+		u32 capacity = graphics_window->draw_id_capacity ? graphics_window->draw_id_capacity : 1024;
+		while (capacity < count) {
+			capacity *= 2;
+		}
+
+		u32 *ids = malloc(capacity * sizeof(u32));
+		for (u32 i = 0; i < capacity; i++) {
+			ids[i] = i;
+		}
+		GL_CALL(glBindBuffer, GL_ARRAY_BUFFER, graphics_window->draw_id_buffer);
+		GL_CALL(glBufferData, GL_ARRAY_BUFFER, capacity * sizeof(u32), ids, GL_STATIC_DRAW);
+		free(ids);
+
+		graphics_window->draw_id_capacity = capacity;
+	}
 
-	GL_CALL(glBindVertexArray, graphics_data->primitive_triangle_vao);
-	GL_CALL(glDrawArrays, GL_TRIANGLES, 0, 3);
+	StreamAllocation items_allocation = stream_buffer_alloc(&graphics_window->stream, count * sizeof(MeshInstance), graphics_window->graphics_data->storage_alignment);
+	MeshInstance *items = items_allocation.ptr;
+	for (u32 i = 0; i < count; i++) {
+		DrawMeshCommandData *data = (DrawMeshCommandData *) entries[i].cmd->data;
+		items[i].transformation = mesh_command_transformation(data);
+		items[i].color = data->color;
+	}
+	stream_buffer_commit(&graphics_window->stream, &items_allocation, items_allocation.size);
+
+	StreamAllocation commands_allocation = stream_buffer_alloc(&graphics_window->stream, count * sizeof(DrawElementsIndirectCommand), sizeof(u32));
+	DrawElementsIndirectCommand *commands = commands_allocation.ptr;
+	for (u32 i = 0; i < count; i++) {
+		DrawMeshCommandData *data = (DrawMeshCommandData *) entries[i].cmd->data;
+		const MeshSlot *slot = mesh_buffer_slot(data->mesh);
+		commands[i].count = data->mesh.num_indices;
+		commands[i].instance_count = 1;
+		commands[i].first_index = slot->first_index;
+		commands[i].base_vertex = slot->base_vertex;
+		commands[i].base_instance = i;
+	}
+	stream_buffer_commit(&graphics_window->stream, &commands_allocation, commands_allocation.size);
+
+	DrawMeshCommandData *first = (DrawMeshCommandData *) entries[0].cmd->data;
+
+	shader_bind(shader_get_basic_indirect());
+	texture_bind(&first->texture);
+	shader_set_mat4(basic_indirect_uniforms.view_projection, &first->projection);
+	shader_set_int(basic_indirect_uniforms.diffuse, 0);
+
+	bind_mesh_vertex_array(graphics_window);
+	GL_CALL(glBindBuffer, GL_ARRAY_BUFFER, graphics_window->draw_id_buffer);
+	GL_CALL(glEnableVertexAttribArray, 8);
+	GL_CALL(glVertexAttribIPointer, 8, 1, GL_UNSIGNED_INT, sizeof(u32), NULL);
+	GL_CALL(glVertexAttribDivisor, 8, 1);
+	gl_state_bind_element_buffer(mesh_buffer_ibo());
+
+	stream_buffer_bind_range(&graphics_window->stream, GL_SHADER_STORAGE_BUFFER, 0, &items_allocation);
+	GL_CALL(glBindBuffer, GL_DRAW_INDIRECT_BUFFER, graphics_window->stream.buffer);
+	GL_CALL(glMultiDrawElementsIndirect, GL_TRIANGLES, GL_UNSIGNED_INT, (const GLvoid *) commands_allocation.offset, count, 0);
+	graphics_window->draw_calls++;
 }
 
-void graphics_draw_rect(GraphicsData *graphics_data, const Transform *transform, mat4 view_projection, const Texture *texture, vec4 color)
+// LSD radix sort on 8-bit digits. Only the (key, command) pairs are moved, so every
+// pass streams through two small arrays instead of the commands and their payloads.
+// Digits that are identical across the whole queue are skipped, which makes the
+// usual case (few layers, few shaders) considerably cheaper than eight passes.
+static void radix_sort(SortEntry *entries, SortEntry *scratch, size_t count)
 {
-	shader_bind(shader_get_basic());
-	texture_bind(texture);
+	size_t histograms[8][256];
+	memset(histograms, 0, sizeof(histograms));
+
+	for (size_t i = 0; i < count; i++) {
+		u64 key = entries[i].key;
+		for (u32 digit = 0; digit < 8; digit++) {
+			histograms[digit][(key >> (digit * 8)) & 0xff]++;
+		}
+	}
+
+	SortEntry *src = entries;
+	SortEntry *dst = scratch;
+	for (u32 digit = 0; digit < 8; digit++) {
+		size_t *histogram = histograms[digit];
+		u32 shift = digit * 8;
+
+		if (histogram[(src[0].key >> shift) & 0xff] == count) {
+			continue;
+		}
+
+		size_t offset = 0;
+		for (u32 i = 0; i < 256; i++) {
+			size_t n = histogram[i];
+			histogram[i] = offset;
+			offset += n;
+		}
+
+		for (size_t i = 0; i < count; i++) {
+			dst[histogram[(src[i].key >> shift) & 0xff]++] = src[i];
+		}
 
-	GLint loc_transformation = glGetUniformLocation(shader_get_basic(), "view_projection");
-	GLint loc_view_projection = glGetUniformLocation(shader_get_basic(), "transformation");
-	GLint loc_color = glGetUniformLocation(shader_get_basic(), "color");
-	GLint loc_diffuse = glGetUniformLocation(shader_get_basic(), "diffuse");
+		SortEntry *temp = src;
+		src = dst;
+		dst = temp;
+	}
+
+	if (src != entries) {
+		memcpy(entries, src, count * sizeof(SortEntry));
+	}
+}
 
-	GL_CALL(glUniformMatrix4fv, loc_transformation, 1, GL_FALSE, mat4_transformation(transform).M);
-	GL_CALL(glUniformMatrix4fv, loc_view_projection, 1, GL_FALSE, view_projection.M);
-	GL_CALL(glUniform4f, loc_color, color.r, color.g, color.b, color.a);
-	GL_CALL(glUniform1i, loc_diffuse, 0);
+// Moves a mesh's bounding sphere into world space. The radius is scaled by the
+// longest axis of the transformation, so non-uniform scales stay conservative.
+static void world_bounding_sphere(const DrawMeshCommandData *data, f32 *x, f32 *y, f32 *z, f32 *radius)
+{
+	mat4 transformation = mesh_command_transformation(data);
+	const BoundingSphere *sphere = &data->mesh.sphere;
+	vec4 center = mat4_mul_vec4(transformation, vec4_new(sphere->center.x, sphere->center.y, sphere->center.z, 1.0f));
+
+	f32 scale_squared = 0.0f;
+	for (u32 i = 0; i < 3; i++) {
+		const f32 *axis = &transformation.M[i * 4];
+		f32 length_squared = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+		if (length_squared > scale_squared) scale_squared = length_squared;
+	}
 
-	GL_CALL(glBindVertexArray, graphics_data->primitive_rect_vao);
-	GL_CALL(glDrawArrays, GL_TRIANGLE_STRIP, 0, 4);
+	*x = center.x;
+	*y = center.y;
+	*z = center.z;
+	*radius = sphere->radius * sqrtf32(scale_squared);
 }
 
-void graphics_draw_mesh(GraphicsData *graphics_data, Mesh mesh, const Transform *transform, mat4 view_projection, const Texture *texture, vec4 color)
+// Drops mesh commands whose bounding sphere lies outside the view frustum. The
+// spheres are gathered into arrays and tested in batches of commands sharing a
+// view-projection, which usually means all meshes of the queue in one batch.
+static void cull_mesh_commands(CommandBucket *bucket)
 {
-	shader_bind(shader_get_basic());
-	texture_bind(texture);
+	size_t count = bucket->size;
+	SortEntry *queue = bucket->entries;
+	Arena *arena = &bucket->arena;
+
+	f32 *xs = arena_push(arena, count * sizeof(f32), ARENA_DEFAULT_ALIGNMENT);
+	f32 *ys = arena_push(arena, count * sizeof(f32), ARENA_DEFAULT_ALIGNMENT);
+	f32 *zs = arena_push(arena, count * sizeof(f32), ARENA_DEFAULT_ALIGNMENT);
+	f32 *radii = arena_push(arena, count * sizeof(f32), ARENA_DEFAULT_ALIGNMENT);
+	u32 *indices = arena_push(arena, count * sizeof(u32), ARENA_DEFAULT_ALIGNMENT);
+	u8 *batch_visible = arena_push(arena, count, ARENA_DEFAULT_ALIGNMENT);
+	u8 *visible = arena_push(arena, count, ARENA_DEFAULT_ALIGNMENT);
+	memset(visible, 1, count);
+
+	const mat4 *projection = NULL;
+	u32 batch_size = 0;
+	for (size_t i = 0; i <= count; i++) {
+		const DrawMeshCommandData *data = NULL;
+		if (i < count && queue[i].cmd->type == DRAW_MESH) {
+			data = (const DrawMeshCommandData *) queue[i].cmd->data;
+		}
 
-	GLint loc_transformation = glGetUniformLocation(shader_get_basic(), "transformation");
-	GLint loc_view_projection = glGetUniformLocation(shader_get_basic(), "view_projection");
-	GLint loc_color = glGetUniformLocation(shader_get_basic(), "color");
-	GLint loc_diffuse = glGetUniformLocation(shader_get_basic(), "diffuse");
+		bool end_of_batch = i == count || (data && projection && memcmp(projection, &data->projection, sizeof(mat4)) != 0);
+		if (end_of_batch && batch_size > 0) {
+			Frustum frustum = frustum_from_view_projection(projection);
+			frustum_cull_spheres(&frustum, xs, ys, zs, radii, batch_size, batch_visible);
+			for (u32 j = 0; j < batch_size; j++) {
+				visible[indices[j]] = batch_visible[j];
+			}
+			batch_size = 0;
+		}
 
-	GL_CALL(glUniformMatrix4fv, loc_transformation, 1, GL_FALSE, mat4_transformation(transform).M);
-	GL_CALL(glUniformMatrix4fv, loc_view_projection, 1, GL_FALSE, view_projection.M);
-	GL_CALL(glUniform4f, loc_color, color.r, color.g, color.b, color.a);
-	GL_CALL(glUniform1i, loc_diffuse, 0);
+		if (data) {
+			projection = &data->projection;
+			world_bounding_sphere(data, &xs[batch_size], &ys[batch_size], &zs[batch_size], &radii[batch_size]);
+			indices[batch_size++] = i;
+		}
+	}
+
+	// The culled entries are moved behind the visible ones instead of dropped,
+	// so command capture still sees everything that was submitted
+	size_t num_visible = 0;
+	size_t num_culled = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (visible[i]) {
+			queue[num_visible++] = queue[i];
+		} else {
+			bucket->scratch[num_culled++] = queue[i];
+		}
+	}
+	memcpy(queue + num_visible, bucket->scratch, num_culled * sizeof(SortEntry));
 
-	GL_CALL(glBindVertexArray, mesh.vao);
-	GL_CALL(glBindBuffer, GL_ELEMENT_ARRAY_BUFFER, mesh.ibo);
-	GL_CALL(glDrawElements, GL_TRIANGLES, mesh.num_indices, GL_UNSIGNED_INT, NULL);
+	bucket->culled_meshes += count - num_visible;
+	bucket->size = num_visible;
 }
 
-static char *get_file_contents(const char *path) // @TODO: centralize this function, it also is in obj_loading
+// Culling and sorting happen on the thread that recorded the bucket
+static void end_bucket(CommandBucket *bucket)
 {
-	FILE *f = fopen(path, "rb");
-	fseek(f, 0, SEEK_END);
-	u64 size = ftell(f);
-	fseek(f, 0, SEEK_SET);
-	char *text = malloc(size + 1);
-	fread(text, size, 1, f);
-	fclose(f);
-	text[size] = 0;
-	return text;
+	PROFILE_FUNCTION();
+
+	bucket->submitted = bucket->size;
+	if (bucket->size > 0) {
+		cull_mesh_commands(bucket);
+	}
+	if (bucket->size > 1) {
+		radix_sort(bucket->entries, bucket->scratch, bucket->size);
+	}
+	bucket->finished = true;
 }
 
-void graphics_draw_text(GraphicsData *graphics_data, const char *text, Font font, Transform *transform, mat4 view_projection)
+// The overflow bucket may still be written to by other threads
+void graphics_end_bucket(GraphicsData *graphics_data, CommandBucket *bucket)
 {
-	shader_bind(shader_get_text());
-	texture_bind(&font.texture);
+	if (!bucket->lock) {
+		end_bucket(bucket);
+	}
+}
+
+static bool heap_less(const CommandBucket *buckets, const size_t *heads, u32 a, u32 b)
+{
+	u64 key_a = buckets[a].entries[heads[a]].key;
+	u64 key_b = buckets[b].entries[heads[b]].key;
+	return key_a < key_b || (key_a == key_b && a < b);
+}
+
+static void heap_sift_down(const CommandBucket *buckets, const size_t *heads, u32 *heap, u32 size, u32 i)
+{
+	for (;;) {
+		u32 smallest = i;
+		u32 left = 2 * i + 1;
+		u32 right = 2 * i + 2;
+		if (left < size && heap_less(buckets, heads, heap[left], heap[smallest])) smallest = left;
+		if (right < size && heap_less(buckets, heads, heap[right], heap[smallest])) smallest = right;
+		if (smallest == i) {
+			break;
+		}
+		u32 temp = heap[i];
+		heap[i] = heap[smallest];
+		heap[smallest] = temp;
+		i = smallest;
+	}
+}
+
+// K-way merge of the sorted buckets into the queue, using a min-heap of bucket
+// heads. Equal keys keep the bucket order, so the result does not depend on timing.
+static void merge_buckets(GraphicsWindow *graphics_window, CommandBucket *buckets, u32 num_buckets)
+{
+	size_t total = 0;
+	u32 heap[GRAPHICS_MAX_COMMAND_BUCKETS];
+	size_t heads[GRAPHICS_MAX_COMMAND_BUCKETS];
+	u32 heap_size = 0;
+	for (u32 i = 0; i < num_buckets; i++) {
+		if (!buckets[i].finished) {
+			end_bucket(&buckets[i]);
+		}
+		graphics_window->culled_meshes += buckets[i].culled_meshes;
+
+		heads[i] = 0;
+		if (buckets[i].size > 0) {
+			heap[heap_size++] = i;
+			total += buckets[i].size;
+		}
+	}
 
-	GLint loc_transformation = glGetUniformLocation(shader_get_text(), "transformation");
-	GLint loc_view_projection = glGetUniformLocation(shader_get_text(), "view_projection");
-	GLint loc_color = glGetUniformLocation(shader_get_text(), "color");
-	GLint loc_diffuse = glGetUniformLocation(shader_get_text(), "diffuse");
+	if (total > graphics_window->queue_capacity) {
+		graphics_window->queue_capacity = graphics_window->queue_capacity ? graphics_window->queue_capacity : 1024;
+		while (graphics_window->queue_capacity < total) {
+			graphics_window->queue_capacity *= 2;
+		}
+		graphics_window->queue = realloc(graphics_window->queue, graphics_window->queue_capacity * sizeof(SortEntry));
+	}
+	graphics_window->queue_size = total;
 
-	vec4 color;
-	GL_CALL(glUniformMatrix4fv, loc_transformation, 1, GL_FALSE, mat4_transformation(transform).M);
-	GL_CALL(glUniformMatrix4fv, loc_view_projection, 1, GL_FALSE, view_projection.M);
-	GL_CALL(glUniform4f, loc_color, color.r, color.g, color.b, color.a);
-	GL_CALL(glUniform1i, loc_diffuse, 0);
+	if (heap_size == 1) {
+		memcpy(graphics_window->queue, buckets[heap[0]].entries, total * sizeof(SortEntry));
+		return;
+	}
 
-	vec2 positions[8 * 256]; // @TODO: static allocation
-	vec2 *uvs = positions + (4 * 256);
+	for (u32 i = heap_size / 2; i-- > 0;) {
+		heap_sift_down(buckets, heads, heap, heap_size, i);
+	}
+
+	for (size_t i = 0; i < total; i++) {
+		u32 top = heap[0];
+		graphics_window->queue[i] = buckets[top].entries[heads[top]++];
+		if (heads[top] == buckets[top].size) {
+			heap[0] = heap[--heap_size];
+		}
+		heap_sift_down(buckets, heads, heap, heap_size, 0);
+	}
+}
+
+static void reset_packet(FramePacket *packet, u32 num_buckets)
+{
+	for (u32 i = 0; i < num_buckets; i++) {
+		CommandBucket *bucket = &packet->buckets[i];
+		bucket->size = 0;
+		bucket->submitted = 0;
+		bucket->culled_meshes = 0;
+		bucket->finished = false;
+		arena_reset(&bucket->arena);
+	}
+	packet->num_buckets = 1;
+}
+
+static u32 packet_num_buckets(const FramePacket *packet)
+{
+	return packet->num_buckets < GRAPHICS_MAX_COMMAND_BUCKETS ? packet->num_buckets : GRAPHICS_MAX_COMMAND_BUCKETS;
+}
+
+static void finish_packet(GraphicsData *graphics_data, FramePacket *packet)
+{
+	u32 num_buckets = packet_num_buckets(packet);
+	for (u32 i = 0; i < num_buckets; i++) {
+		if (!packet->buckets[i].finished) {
+			end_bucket(&packet->buckets[i]);
+		}
+	}
+}
+
+static u64 hash_bytes(u64 hash, const void *data, size_t size)
+{
+	const u8 *bytes = data;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+// Only the fields that affect drawing are hashed; the payloads also hold
+// pointers and padding, which change from frame to frame
+static u64 hash_command(const DrawCommand *cmd)
+{
+	u64 hash = 14695981039346656037ull;
+	hash = hash_bytes(hash, &cmd->key, sizeof(cmd->key));
+	hash = hash_bytes(hash, &cmd->type, sizeof(cmd->type));
+	hash = hash_bytes(hash, &cmd->layer, sizeof(cmd->layer));
+
+	if (cmd->type == DRAW_TRIANGLE || cmd->type == DRAW_RECT) {
+		// Both payloads have the same layout
+		DrawRectCommandData *data = (DrawRectCommandData *) cmd->data;
+		hash = hash_bytes(hash, &data->transform, sizeof(Transform));
+		hash = hash_bytes(hash, &data->projection, sizeof(mat4));
+		hash = hash_bytes(hash, &data->texture.id, sizeof(GLuint));
+		hash = hash_bytes(hash, &data->color, sizeof(vec4));
+	} else if (cmd->type == DRAW_MESH) {
+		DrawMeshCommandData *data = (DrawMeshCommandData *) cmd->data;
+		hash = hash_bytes(hash, &data->mesh.id, sizeof(u32));
+		hash = hash_bytes(hash, &data->transform, sizeof(Transform));
+		hash = hash_bytes(hash, &data->projection, sizeof(mat4));
+		hash = hash_bytes(hash, &data->texture.id, sizeof(GLuint));
+		hash = hash_bytes(hash, &data->color, sizeof(vec4));
+		hash = hash_bytes(hash, &data->has_parent, sizeof(bool));
+		if (data->has_parent) {
+			hash = hash_bytes(hash, &data->parent, sizeof(mat4));
+		}
+	} else if (cmd->type == DRAW_TEXT) {
+		DrawTextCommandData *data = (DrawTextCommandData *) cmd->data;
+		hash = hash_bytes(hash, data->text, strlen(data->text));
+		hash = hash_bytes(hash, &data->transform, sizeof(Transform));
+		hash = hash_bytes(hash, &data->projection, sizeof(mat4));
+		hash = hash_bytes(hash, &data->font.texture.id, sizeof(GLuint));
+	}
+
+	// Final mix, so that summing the hashes below does not cancel out bits
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdull;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+// Which recording thread put a command into which bucket can change from frame
+// to frame, so the command hashes are combined independently of their order.
+// The order that matters for drawing is the sort key's, which is hashed.
+static u64 hash_packet(const FramePacket *packet)
+{
+	u64 result = 0;
+	u32 num_buckets = packet_num_buckets(packet);
+	for (u32 i = 0; i < num_buckets; i++) {
+		const CommandBucket *bucket = &packet->buckets[i];
+		for (size_t j = 0; j < bucket->size; j++) {
+			result += hash_command(bucket->entries[j].cmd);
+		}
+	}
+	return result;
+}
+
+static bool repeats_presented_frame(GraphicsWindow *graphics_window, const FramePacket *packet)
+{
+	u64 hash = hash_packet(packet);
+	bool result = graphics_window->presented
+		&& hash == graphics_window->presented_hash
+		&& graphics_window->events == graphics_window->presented_events
+		&& !graphics_window->capture_request.requested;
+
+	graphics_window->presented = !graphics_window->drawn_immediately;
+	graphics_window->presented_hash = hash;
+	graphics_window->presented_events = graphics_window->events;
+	return result;
+}
+
+// Buckets claimed by other threads have to be ended, or at least no longer
+// written to, before this is called. With a render thread the packet is only
+// culled and sorted here and drawn after graphics_end_frame hands it over.
+void graphics_sort_and_flush_queue(GraphicsData *graphics_data)
+{
+	GraphicsWindow *graphics_window = graphics_data->recording_window;
+	FramePacket *packet = graphics_window->recording;
+	finish_packet(graphics_data, packet);
+	if (command_capture_active()) {
+		command_capture_write_flush(packet->buckets, packet_num_buckets(packet));
+	}
+	memcpy(packet->layers, graphics_data->layers, sizeof(packet->layers));
+
+	graphics_window->idle = graphics_window->graphics_data->skip_idle_frames && repeats_presented_frame(graphics_window, packet);
+	if (!graphics_window->render_thread_running && !graphics_window->idle) {
+		render_packet(graphics_window, packet);
+	}
+}
+
+// Runs between layers, after the sprite batch was flushed
+static void apply_layer_state(const LayerConfig *config)
+{
+	if (config->depth_test) {
+		gl_state_enable(GL_DEPTH_TEST);
+	} else {
+		gl_state_disable(GL_DEPTH_TEST);
+	}
+	gl_state_depth_mask(config->depth_write);
+
+	if (config->blend) {
+		gl_state_enable(GL_BLEND);
+		GL_CALL(glBlendFunc, GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	} else {
+		gl_state_disable(GL_BLEND);
+	}
+}
+
+static const char *pass_name(enum DrawCommandType type)
+{
+	switch (type) {
+		case DRAW_MESH: return "meshes";
+		case DRAW_TEXT: return "text";
+		default: return "sprites";
+	}
+}
+
+static void render_packet(GraphicsWindow *graphics_window, FramePacket *packet)
+{
+	PROFILE_FUNCTION();
+
+	GPUProfiler *profiler = &graphics_window->gpu_profiler;
+	u32 num_buckets = packet_num_buckets(packet);
+
+	// Merging
+	merge_buckets(graphics_window, packet->buckets, num_buckets);
+	size_t count = graphics_window->queue_size;
+
+	// Flushing
+	gpu_profiler_begin(profiler, "flush");
+	u32 layer = 0;
+	const char *pass = NULL;
+	for (u32 i = 0; i < count;) {
+		const DrawCommand *cmd = graphics_window->queue[i].cmd;
+
+		// GPU profiler scopes per layer and, within it, per kind of draw. The sprite
+		// batch is flushed as a scope ends, so that batched draws are measured in it.
+		if (pass == NULL || cmd->layer != layer || pass_name(cmd->type) != pass) {
+			if (pass) {
+				sprite_batch_flush(&graphics_window->sprite_batch);
+				gpu_profiler_end(profiler);
+			}
+			if (pass == NULL || cmd->layer != layer) {
+				if (pass) {
+					gpu_profiler_end(profiler);
+				}
+				char name[GPU_PROFILER_NAME_LENGTH];
+				snprintf(name, sizeof(name), "layer %u", cmd->layer);
+				gpu_profiler_begin(profiler, name);
+				layer = cmd->layer;
+				apply_layer_state(&packet->layers[layer]);
+			}
+			pass = pass_name(cmd->type);
+			gpu_profiler_begin(profiler, pass);
+		}
+
+		// Sorting puts meshes with equal state next to each other. With multi-draw
+		// indirect each such bucket becomes one call, otherwise runs of the same mesh
+		// become one instanced draw.
+		u32 run = 1;
+		if (cmd->type == DRAW_MESH && graphics_window->graphics_data->use_indirect) {
+			while (i + run < count && mesh_commands_share_state(cmd, graphics_window->queue[i + run].cmd)) {
+				run++;
+			}
+		} else if (cmd->type == DRAW_MESH) {
+			while (i + run < count && mesh_commands_compatible(cmd, graphics_window->queue[i + run].cmd)) {
+				run++;
+			}
+		}
+
+		if (run > 1 && graphics_window->graphics_data->use_indirect) {
+			draw_meshes_indirect(graphics_window, graphics_window->queue + i, run);
+		} else if (run > 1) {
+			StreamAllocation allocation;
+			MeshInstance *instances = begin_instances(graphics_window, run, &allocation);
+			for (u32 j = 0; j < run; j++) {
+				DrawMeshCommandData *data = (DrawMeshCommandData *) graphics_window->queue[i + j].cmd->data;
+				instances[j].transformation = mesh_command_transformation(data);
+				instances[j].color = data->color;
+			}
+
+			DrawMeshCommandData *first = (DrawMeshCommandData *) cmd->data;
+			draw_mesh_instances(graphics_window, first->mesh, &allocation, first->projection, &first->texture);
+		} else {
+			exexute_draw_command(graphics_window, cmd);
+		}
+
+		i += run;
+	}
+	sprite_batch_flush(&graphics_window->sprite_batch);
+	if (pass) {
+		// Immediate draws, and clearing the depth buffer, expect the defaults
+		apply_layer_state(&default_layer);
+		gpu_profiler_end(profiler);
+		gpu_profiler_end(profiler);
+	}
+	gpu_profiler_end(profiler);
+
+	reset_packet(packet, num_buckets);
+	graphics_window->queue_size = 0;
+}
+
+// Triangles and rects are not drawn right away, but added to the sprite batch,
+// which is flushed when a different kind of draw or the end of the frame comes.
+static void draw_triangle(GraphicsWindow *graphics_window, const Transform *transform, mat4 view_projection, const Texture *texture, vec4 color)
+{
+	mat4 mvp = mat4_mul(mat4_transformation(transform), view_projection);
+	sprite_batch_push_triangle(&graphics_window->sprite_batch, &mvp, shader_get_sprite(), texture->id, color);
+}
+
+static void draw_rect(GraphicsWindow *graphics_window, const Transform *transform, mat4 view_projection, const Texture *texture, vec4 color)
+{
+	mat4 mvp = mat4_mul(mat4_transformation(transform), view_projection);
+	sprite_batch_push_rect(&graphics_window->sprite_batch, &mvp, shader_get_sprite(), texture->id, color);
+}
+
+static void draw_mesh(GraphicsWindow *graphics_window, Mesh mesh, mat4 transformation, mat4 view_projection, const Texture *texture, vec4 color)
+{
+	sprite_batch_flush(&graphics_window->sprite_batch);
+
+	shader_bind(shader_get_basic());
+	texture_bind(texture);
+
+	shader_set_mat4(basic_uniforms.transformation, &transformation);
+	shader_set_mat4(basic_uniforms.view_projection, &view_projection);
+	shader_set_vec4(basic_uniforms.color, color);
+	shader_set_int(basic_uniforms.diffuse, 0);
+
+	const MeshSlot *slot = mesh_buffer_slot(mesh);
+	bind_mesh_vertex_array(graphics_window);
+	gl_state_bind_element_buffer(mesh_buffer_ibo());
+	GL_CALL(glDrawElementsBaseVertex, GL_TRIANGLES, mesh.num_indices, GL_UNSIGNED_INT, (const GLvoid *) (slot->first_index * sizeof(u32)), slot->base_vertex);
+	graphics_window->draw_calls++;
+}
+
+// Glyph quads go into the sprite batch, so every string using the same font atlas
+// ends up in the same draw call as long as nothing else is drawn in between.
+static void draw_text(GraphicsWindow *graphics_window, const char *text, Font font, const Transform *transform, mat4 view_projection)
+{
+	mat4 mvp = mat4_mul(mat4_transformation(transform), view_projection);
+	vec4 color = {{1, 1, 1, 1}};
 
 	f32 x = 0.0f;
 	f32 y = 0.0f;
-	u32 i = 0;
-	while (text[i]) {
-		if (text[i] >= 32 /*&& text[i] < 128*/) {
+	for (const char *c = text; *c; c++) {
+		if (*c >= 32 && *c < 128) {
 			stbtt_aligned_quad q;
-			stbtt_GetBakedQuad(font.char_data, 512, 512, text[i] - 32, &x, &y, &q, 1);
+			stbtt_GetBakedQuad(font.char_data, 512, 512, *c - 32, &x, &y, &q, 1);
 
-			positions[4 * i + 0].x = q.x0; positions[4 * i + 0].y = q.y1;
-			positions[4 * i + 1].x = q.x1; positions[4 * i + 1].y = q.y1;
-			positions[4 * i + 3].x = q.x1; positions[4 * i + 3].y = q.y0;
-			positions[4 * i + 2].x = q.x0; positions[4 * i + 2].y = q.y0;
-
-			uvs[4 * i + 0].x = q.s0; uvs[4 * i + 0].y = q.t1;
-			uvs[4 * i + 1].x = q.s1; uvs[4 * i + 1].y = q.t1;
-			uvs[4 * i + 3].x = q.s1; uvs[4 * i + 3].y = q.t0;
-			uvs[4 * i + 2].x = q.s0; uvs[4 * i + 2].y = q.t0;
+			sprite_batch_push_quad(&graphics_window->sprite_batch, &mvp, shader_get_text(), font.texture.id,
+								   vec2_new(q.x0, q.y0), vec2_new(q.x1, q.y1), vec2_new(q.s0, q.t0), vec2_new(q.s1, q.t1), color);
 		}
+	}
+}
 
-		i++;
+// The immediate draw functions draw into the window whose frame was begun last
+// on the calling thread
+// Immediate draws are not hashed, so neither this frame nor the next one may
+// repeat the last presented frame. Threads without a current window, such as
+// the main thread once a render thread owns the context, can not draw.
+static bool begin_immediate_draw(const char *function)
+{
+	GraphicsWindow *graphics_window = context_window;
+	if (!graphics_window) {
+		ERROR("%s needs a frame begun on this thread; with a render thread, submit commands instead.", function);
+		return false;
 	}
 
-	GLuint vao, vbo;
-	GL_CALL(glGenVertexArrays, 1, &vao);
-	GL_CALL(glBindVertexArray, vao);
-	GL_CALL(glGenBuffers, 1, &vbo);
-	GL_CALL(glBindBuffer, GL_ARRAY_BUFFER, vbo);
-	GL_CALL(glBufferData, GL_ARRAY_BUFFER, sizeof(positions), positions, GL_STATIC_DRAW);
-	// GL_CALL(glBufferSubData, GL_ARRAY_BUFFER, sizeof(positions), sizeof(uvs), uvs);
-	GL_CALL(glEnableVertexAttribArray, 0);
-	GL_CALL(glEnableVertexAttribArray, 1);
-	GL_CALL(glVertexAttribPointer, 0, 2, GL_FLOAT, GL_FALSE, 0, NULL);
-	GL_CALL(glVertexAttribPointer, 1, 2, GL_FLOAT, GL_FALSE, 0, (const GLvoid *) (sizeof(vec2) * 4 * 256));
-	GL_CALL(glBindVertexArray, 0);
-	GL_CALL(glDeleteBuffers, 1, &vbo);
+	graphics_window->drawn_immediately = true;
+	graphics_window->presented = false;
+	cancel_idle_frame(graphics_window);
+	return true;
+}
 
-	GL_CALL(glBindVertexArray, vao);
-	GL_CALL(glDrawArrays, GL_TRIANGLE_STRIP, 0, i * 4);
+void graphics_draw_triangle(GraphicsData *graphics_data, const Transform *transform, mat4 view_projection, const Texture *texture, vec4 color)
+{
+	if (!begin_immediate_draw(__func__)) {
+		return;
+	}
+	draw_triangle(context_window, transform, view_projection, texture, color);
+}
 
-	GL_CALL(glDeleteVertexArrays, 1, &vao);
+void graphics_draw_rect(GraphicsData *graphics_data, const Transform *transform, mat4 view_projection, const Texture *texture, vec4 color)
+{
+	if (!begin_immediate_draw(__func__)) {
+		return;
+	}
+	draw_rect(context_window, transform, view_projection, texture, color);
+}
+
+void graphics_draw_mesh(GraphicsData *graphics_data, Mesh mesh, const Transform *transform, mat4 view_projection, const Texture *texture, vec4 color)
+{
+	if (!begin_immediate_draw(__func__)) {
+		return;
+	}
+	draw_mesh(context_window, mesh, mat4_transformation(transform), view_projection, texture, color);
+}
+
+void graphics_draw_mesh_instanced(GraphicsData *graphics_data, Mesh mesh, const Transform *transforms, u32 count, mat4 view_projection, const Texture *texture, const vec4 *colors)
+{
+	if (count == 0 || !begin_immediate_draw(__func__)) {
+		return;
+	}
+
+	StreamAllocation allocation;
+	MeshInstance *instances = begin_instances(context_window, count, &allocation);
+	for (u32 i = 0; i < count; i++) {
+		instances[i].transformation = mat4_transformation(&transforms[i]);
+		instances[i].color = colors ? colors[i] : vec4_zero();
+	}
+
+	draw_mesh_instances(context_window, mesh, &allocation, view_projection, texture);
+}
+
+void graphics_draw_text(GraphicsData *graphics_data, const char *text, Font font, Transform *transform, mat4 view_projection)
+{
+	if (!begin_immediate_draw(__func__)) {
+		return;
+	}
+	draw_text(context_window, text, font, transform, view_projection);
+}
+
+static char *get_file_contents(const char *path) // @TODO: centralize this function, it also is in obj_loading
+{
+	FILE *f = fopen(path, "rb");
+	fseek(f, 0, SEEK_END);
+	u64 size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	char *text = malloc(size + 1);
+	fread(text, size, 1, f);
+	fclose(f);
+	text[size] = 0;
+	return text;
 }
 
 Font font_load(const char *path, f32 size)
@@ -422,6 +1744,8 @@ Font font_load(const char *path, f32 size)
 	Font result;
 	stbtt_BakeFontBitmap((const unsigned char *) ttf_buffer, 0, size, temp_bitmap, 512, 512, 32, 96, result.char_data);
 	texture_init(&result.texture, 512, 512, GL_RED, GL_UNSIGNED_BYTE, temp_bitmap);
+	result.texture.data = NULL; // temp_bitmap is not the texture's to free
+	resource_registry_add(RESOURCE_FONT, result.texture.id, path, size);
 
 	free(ttf_buffer);
 
@@ -430,6 +1754,7 @@ Font font_load(const char *path, f32 size)
 
 void font_destroy(Font *font)
 {
+	resource_registry_remove(RESOURCE_FONT, font->texture.id);
 	texture_destroy(&font->texture);
 }
 
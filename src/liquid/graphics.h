@@ -1,13 +1,24 @@
 #pragma once
 
 #include "common.h"
+#include "arena.h"
 #include "maths.h"
 #include "texture.h"
+#include "sprite_batch.h"
+#include "stream_buffer.h"
+#include "mesh_buffer.h"
+#include "culling.h"
+#include "gpu_profiler.h"
+#include "frame_capture.h"
+#include "headless.h"
 
 #include "stb/stb_truetype.h"
 
+#include <pthread.h>
+
 #define GRAPHICS_MAX_WINDOWS 16
 #define GRAPHICS_MAX_LAYERS 32
+#define GRAPHICS_MAX_COMMAND_BUCKETS 64
 
 typedef u32 Window;
 
@@ -22,23 +33,188 @@ enum DrawCommandType
 typedef struct
 {
 	enum DrawCommandType type;
+	u32 layer;
+	u64 key;
 	void *data;
 } DrawCommand;
 
+// Fields that can be packed into a DrawCommand's 64-bit sort key
+typedef enum
+{
+	SORT_KEY_LAYER,
+	SORT_KEY_SHADER,
+	SORT_KEY_TEXTURE,
+	SORT_KEY_MESH,
+	SORT_KEY_DEPTH,
+	SORT_KEY_NUM_FIELDS
+} SortKeyField;
+
+// One slot of a key layout; layouts are given most significant slot first
+typedef struct
+{
+	SortKeyField field;
+	u8 bits;
+} SortKeySlot;
+
+typedef struct
+{
+	u8 shift[SORT_KEY_NUM_FIELDS];
+	u8 bits[SORT_KEY_NUM_FIELDS];
+} SortKeyLayout;
+
+// How the commands of one layer are ordered. Layers themselves are drawn in
+// ascending order, as the layer is the most significant field of the sort key.
+typedef enum
+{
+	LAYER_SORT_STATE, // By the sort key layout, to change as little state as possible
+	LAYER_SORT_FRONT_TO_BACK, // Opaque geometry, so that early depth tests reject more
+	LAYER_SORT_BACK_TO_FRONT, // Transparent geometry, so that blending is correct
+	LAYER_SORT_SUBMISSION // UI; buckets are kept in the order they were begun
+} LayerSortPolicy;
+
+typedef struct
+{
+	LayerSortPolicy sort;
+	bool depth_test;
+	bool depth_write;
+	bool blend; // Alpha blending, source over destination
+} LayerConfig;
+
+typedef struct
+{
+	u64 key;
+	DrawCommand *cmd;
+} SortEntry;
+
+// Commands recorded by one thread. A bucket is only touched by its owner until
+// graphics_end_bucket, which culls and sorts it there, so recording needs no
+// locks. The sorted buckets are merged on the GL thread when the queue is flushed.
+typedef struct
+{
+	Arena arena;
+	size_t size;
+	size_t submitted; // Culling keeps the dropped entries after the first size
+	size_t capacity;
+	SortEntry *entries;
+	SortEntry *scratch;
+	u32 culled_meshes;
+	bool finished;
+	pthread_mutex_t *lock; // Only the overflow bucket has one, as threads share it
+} CommandBucket;
+
+// Everything recorded for one frame. There are two, so that with a render thread
+// one frame can be drawn while the next one is recorded.
 typedef struct
+{
+	CommandBucket buckets[GRAPHICS_MAX_COMMAND_BUCKETS];
+	u32 num_buckets;
+	pthread_mutex_t overflow_mutex;
+	FrameCaptureRequest capture;
+	// Copied when the queue is flushed, so that graphics_set_layer on the
+	// recording thread does not change a packet being drawn
+	LayerConfig layers[GRAPHICS_MAX_LAYERS];
+} FramePacket;
+
+// Counters of the last frame that was drawn
+typedef struct
+{
+	u32 draw_calls;
+	u32 state_changes; // GL state calls that reached the driver
+	u32 redundant_state_changes; // Filtered out by gl_state
+	u32 culled_meshes;
+} FrameStats;
+
+// Per-instance vertex data streamed for instanced mesh draws
+typedef struct
+{
+	mat4 transformation;
+	vec4 color;
+} MeshInstance;
+
+typedef struct GraphicsData GraphicsData;
+
+// Everything one window draws with. Each window has a GL context of its own,
+// which shares textures, buffers and shaders with the other windows' contexts,
+// and a command queue of its own, so windows can be drawn on separate threads.
+typedef struct
+{
+	GLFWwindow *handle; // NULL for the headless framebuffer
+	GraphicsData *graphics_data;
+
+	SpriteBatch sprite_batch;
+
+	StreamBuffer stream;
+
+	GPUProfiler gpu_profiler;
+	FrameCapture frame_capture;
+	FrameCaptureRequest capture_request; // For the frame being recorded
+
+	GLuint draw_id_buffer;
+	u32 draw_id_capacity;
+
+	// Vertex arrays are not shared between contexts, so each window sets up its
+	// own for the mesh buffer, again whenever the buffer was reallocated
+	GLuint mesh_vao;
+	u32 mesh_vao_generation;
+
+	// Bucket 0 of the recording packet takes graphics_submit_call, the others are
+	// claimed by recording threads. Command headers and their payloads live in the
+	// bucket's arena until the queue is flushed, which merges all buckets into queue.
+	FramePacket packets[2];
+	FramePacket *recording;
+	size_t queue_size;
+	size_t queue_capacity;
+	SortEntry *queue;
+
+	// Mesh commands dropped by frustum culling since graphics_begin_frame
+	u32 culled_meshes;
+	// Mesh draw calls since graphics_begin_frame; the sprite batch counts its own
+	u32 draw_calls;
+	FrameStats frame_stats;
+
+	// What the last presented frame was made of, see graphics_set_idle_skipping
+	bool presented;
+	u64 presented_hash;
+	u32 presented_events;
+	u32 events; // Input and window events received so far
+	bool drawn_immediately; // The frame being recorded has draws outside the queue
+	bool idle; // The frame being recorded repeats the last presented one
+
+	// Optional thread that owns the context, see graphics_start_render_thread
+	bool render_thread_running;
+	bool render_thread_quit;
+	pthread_t render_thread;
+	pthread_mutex_t render_mutex;
+	pthread_cond_t render_cond;
+	FramePacket *render_packet; // Handed over and not drawn yet
+} GraphicsWindow;
+
+struct GraphicsData
 {
 	bool initialized;
 	u32 num_windows;
-	GLFWwindow* windows[GRAPHICS_MAX_WINDOWS];
-	u32 indices[GRAPHICS_MAX_WINDOWS];
+	GraphicsWindow *windows[GRAPHICS_MAX_WINDOWS]; // Indexed by Window, NULL when closed
 
-	GLuint primitive_triangle_vao;
-	GLuint primitive_rect_vao;
+	// The window between graphics_begin_frame and graphics_end_frame, which
+	// submitted commands are recorded for
+	GraphicsWindow *recording_window;
 
-	size_t queue_capacity;
-	size_t queue_size;
-	DrawCommand *queue;
-} GraphicsData;
+	// Multi-draw indirect path for meshes, used when the driver supports it
+	bool use_indirect;
+	GLint storage_alignment;
+
+	SortKeyLayout sort_key_layout;
+	LayerConfig layers[GRAPHICS_MAX_LAYERS];
+
+	bool skip_idle_frames;
+	f64 idle_timeout; // Seconds
+
+	// Set when drawing without a window system, see graphics_create_headless
+	bool headless;
+#ifdef GRAPHICS_HEADLESS
+	HeadlessContext headless_context;
+#endif
+};
 
 typedef struct
 {
@@ -48,35 +224,95 @@ typedef struct
 
 typedef struct
 {
-	GLuint vao, ibo;
-	u32 num_indices;
-} Mesh;
+	stbtt_bakedchar char_data[96];
+	Texture texture;
+} Font;
 
 typedef struct
 {
-	stbtt_bakedchar char_data[96];
+	Transform transform;
+	mat4 projection;
 	Texture texture;
-} Font;
+	vec4 color;
+} DrawTriangleCommandData;
+
+typedef struct
+{
+	Transform transform;
+	mat4 projection;
+	Texture texture;
+	vec4 color;
+} DrawRectCommandData;
+
+typedef struct
+{
+	Mesh mesh;
+	Transform transform;
+	mat4 projection;
+	Texture texture;
+	vec4 color;
+	// With has_parent, transform is relative to the world matrix parent, e.g.
+	// of a TransformHierarchy node; the two are combined with mat4_mul
+	bool has_parent;
+	mat4 parent;
+} DrawMeshCommandData;
+
+typedef struct
+{
+	const char *text;
+	Transform transform;
+	mat4 projection;
+	Font font;
+} DrawTextCommandData;
 
 Window graphics_create_window(GraphicsData *graphics_data, u32 width, u32 height, const char *title);
+#ifdef GRAPHICS_HEADLESS
+Window graphics_create_headless(GraphicsData *graphics_data, u32 width, u32 height);
+#endif
 void graphics_destroy_window(GraphicsData *graphics_data, Window *window);
 void *graphics_get_window_ptr(GraphicsData *graphics_data, Window window);
+GraphicsWindow *graphics_get_window(GraphicsData *graphics_data, Window window);
 bool graphics_terminated(GraphicsData *graphics_data);
 void graphics_begin_frame(GraphicsData *graphics_data, Window *window);
 void graphics_end_frame(GraphicsData *graphics_data, Window *window);
 
+FrameStats graphics_frame_stats(GraphicsData *graphics_data, Window window);
+
+// Captures the frame being recorded once it is drawn. The pixels are read back
+// a few frames later, and path is written on a worker thread after that.
+void graphics_capture_frame_async(GraphicsData *graphics_data, const char *path, FrameCaptureFormat format);
+
+// Opt-in: a frame whose commands and transforms are the same as in the last
+// presented one, with no input or window event in between, is not drawn.
+// Once all windows are idle, graphics_end_frame blocks until an event arrives
+// or timeout seconds have passed, instead of redrawing at full rate. Immediate
+// draws, layer changes and frame captures always get the frame drawn.
+void graphics_set_idle_skipping(GraphicsData *graphics_data, bool enabled, f64 timeout);
+
+void graphics_start_render_thread(GraphicsData *graphics_data, Window window);
+void graphics_stop_render_thread(GraphicsData *graphics_data, Window window);
+
 void graphics_hide_cursor(GraphicsData *graphics_data, Window window);
 void graphics_disable_cursor(GraphicsData *graphics_data, Window window);
 void graphics_show_cursor(GraphicsData *graphics_data, Window window);
 
+void graphics_set_sort_key_layout(GraphicsData *graphics_data, const SortKeySlot *slots, u32 num_slots);
+// Layers default to LAYER_SORT_STATE with depth test and writes and no blending.
+// Changes take effect with the next commands submitted, so make them between frames.
+void graphics_set_layer(GraphicsData *graphics_data, u32 layer, const LayerConfig *config);
 void graphics_submit_call(GraphicsData *graphics_data, DrawCommand *cmd);
+CommandBucket *graphics_begin_bucket(GraphicsData *graphics_data);
+void graphics_bucket_submit(GraphicsData *graphics_data, CommandBucket *bucket, DrawCommand *cmd);
+void graphics_end_bucket(GraphicsData *graphics_data, CommandBucket *bucket);
 void graphics_sort_and_flush_queue(GraphicsData *graphics_data);
 
 void graphics_draw_triangle(GraphicsData *graphics_data, const Transform *transform, mat4 view_projection, const Texture *texture, vec4 color);
 void graphics_draw_rect(GraphicsData *graphics_data, const Transform *transform, mat4 view_projection, const Texture *texture, vec4 color);
 void graphics_draw_mesh(GraphicsData *graphics_data, Mesh mesh, const Transform *transform, mat4 view_projection, const Texture *texture, vec4 color);
+void graphics_draw_mesh_instanced(GraphicsData *graphics_data, Mesh mesh, const Transform *transforms, u32 count, mat4 view_projection, const Texture *texture, const vec4 *colors);
 void graphics_draw_text(GraphicsData *graphics_data, const char *text, Font font, Transform *transform, mat4 view_projection);
 
 Font font_load(const char *path, f32 size);
+void font_destroy(Font *font);
 
 mat4 camera_view_projection(const Camera *camera);
\ No newline at end of file
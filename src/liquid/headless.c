@@ -0,0 +1,142 @@
+#include "headless.h"
+
+#ifdef GRAPHICS_HEADLESS
+
+#include <string.h>
+
+static EGLDisplay get_display()
+{
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+	const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+
+	if (get_platform_display && extensions && strstr(extensions, "EGL_MESA_platform_surfaceless")) {
+		EGLDisplay result = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+		if (result != EGL_NO_DISPLAY) {
+			return result;
+		}
+	}
+
+	WARN("EGL_MESA_platform_surfaceless is not available, using the default EGL display.");
+	return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+bool headless_context_create(HeadlessContext *headless, u32 width, u32 height)
+{
+	headless->width = width;
+	headless->height = height;
+	headless->framebuffer = 0;
+	headless->color_buffer = 0;
+	headless->depth_buffer = 0;
+
+	headless->display = get_display();
+	EGLint major, minor;
+	if (headless->display == EGL_NO_DISPLAY || !eglInitialize(headless->display, &major, &minor)) {
+		ERROR("Failed to initialize EGL (error code: 0x%x).", eglGetError());
+		return false;
+	}
+	INFO("Initialized EGL %d.%d.", major, minor);
+
+	if (!strstr(eglQueryString(headless->display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context")) {
+		ERROR("EGL_KHR_surfaceless_context is not supported.");
+		eglTerminate(headless->display);
+		return false;
+	}
+
+	// Nothing is drawn to the surface, but Mesa's surfaceless platform only
+	// offers configs for pbuffers and none without a surface type
+	const EGLint config_attributes[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint num_configs = 0;
+	eglChooseConfig(headless->display, config_attributes, &config, 1, &num_configs);
+
+	// Same version and profile as the windowed contexts
+	const EGLint context_attributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 4,
+		EGL_CONTEXT_MINOR_VERSION, 1,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+
+	eglBindAPI(EGL_OPENGL_API);
+	headless->context = num_configs > 0 ? eglCreateContext(headless->display, config, EGL_NO_CONTEXT, context_attributes) : EGL_NO_CONTEXT;
+	if (headless->context == EGL_NO_CONTEXT) {
+		ERROR("Failed to create EGL context (error code: 0x%x).", eglGetError());
+		eglTerminate(headless->display);
+		return false;
+	}
+
+	return headless_context_make_current(headless);
+}
+
+void headless_context_create_framebuffer(HeadlessContext *headless)
+{
+	GL_CALL(glGenRenderbuffers, 1, &headless->color_buffer);
+	GL_CALL(glBindRenderbuffer, GL_RENDERBUFFER, headless->color_buffer);
+	GL_CALL(glRenderbufferStorage, GL_RENDERBUFFER, GL_RGBA8, headless->width, headless->height);
+
+	GL_CALL(glGenRenderbuffers, 1, &headless->depth_buffer);
+	GL_CALL(glBindRenderbuffer, GL_RENDERBUFFER, headless->depth_buffer);
+	GL_CALL(glRenderbufferStorage, GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, headless->width, headless->height);
+
+	GL_CALL(glGenFramebuffers, 1, &headless->framebuffer);
+	GL_CALL(glBindFramebuffer, GL_FRAMEBUFFER, headless->framebuffer);
+	GL_CALL(glFramebufferRenderbuffer, GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, headless->color_buffer);
+	GL_CALL(glFramebufferRenderbuffer, GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, headless->depth_buffer);
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		ERROR("Headless framebuffer is incomplete (status: 0x%x).", status);
+	}
+	headless_context_bind_framebuffer(headless);
+}
+
+void headless_context_destroy(HeadlessContext *headless)
+{
+	if (headless->framebuffer) {
+		GL_CALL(glBindFramebuffer, GL_FRAMEBUFFER, 0);
+		GL_CALL(glDeleteFramebuffers, 1, &headless->framebuffer);
+		GL_CALL(glDeleteRenderbuffers, 1, &headless->color_buffer);
+		GL_CALL(glDeleteRenderbuffers, 1, &headless->depth_buffer);
+	}
+
+	headless_context_release();
+	eglDestroyContext(headless->display, headless->context);
+	eglTerminate(headless->display);
+	headless->context = EGL_NO_CONTEXT;
+	headless->display = EGL_NO_DISPLAY;
+}
+
+bool headless_context_make_current(HeadlessContext *headless)
+{
+	if (!eglMakeCurrent(headless->display, EGL_NO_SURFACE, EGL_NO_SURFACE, headless->context)) {
+		ERROR("Failed to make the EGL context current (error code: 0x%x).", eglGetError());
+		return false;
+	}
+	return true;
+}
+
+bool headless_context_is_current(const HeadlessContext *headless)
+{
+	return eglGetCurrentContext() == headless->context;
+}
+
+void headless_context_release()
+{
+	EGLDisplay display = eglGetCurrentDisplay();
+	if (display != EGL_NO_DISPLAY) {
+		eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	}
+}
+
+// There is no default framebuffer to fall back to, so this is bound every frame
+void headless_context_bind_framebuffer(HeadlessContext *headless)
+{
+	GL_CALL(glBindFramebuffer, GL_FRAMEBUFFER, headless->framebuffer);
+	GL_CALL(glViewport, 0, 0, headless->width, headless->height);
+}
+
+#endif
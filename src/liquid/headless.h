@@ -0,0 +1,40 @@
+#pragma once
+
+// Only built with GRAPHICS_HEADLESS, which needs libEGL to link
+#ifdef GRAPHICS_HEADLESS
+
+#include "common.h"
+
+#include <GL/glew.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+// GL context without a window system. The context comes from EGL on Mesa's
+// surfaceless platform (falling back to the default display), so it works on
+// machines without X or Wayland, including with llvmpipe. Having no default
+// framebuffer, it renders into a framebuffer object of the given size.
+typedef struct
+{
+	EGLDisplay display;
+	EGLContext context;
+
+	GLuint framebuffer;
+	GLuint color_buffer;
+	GLuint depth_buffer;
+	u32 width;
+	u32 height;
+} HeadlessContext;
+
+// Creates the context and makes it current. The framebuffer needs GL functions,
+// so it is created separately, once GLEW is initialized.
+bool headless_context_create(HeadlessContext *headless, u32 width, u32 height);
+void headless_context_create_framebuffer(HeadlessContext *headless);
+void headless_context_destroy(HeadlessContext *headless);
+
+bool headless_context_make_current(HeadlessContext *headless);
+bool headless_context_is_current(const HeadlessContext *headless);
+void headless_context_release();
+
+void headless_context_bind_framebuffer(HeadlessContext *headless);
+
+#endif
@@ -1,5 +1,6 @@
 #include "input.h"
 #include "graphics.h"
+#include "cpu_profiler.h"
 
 void input_initialize(InputData *input_data, GraphicsData *graphics_data, Window window)
 {
@@ -8,6 +9,8 @@ void input_initialize(InputData *input_data, GraphicsData *graphics_data, Window
 
 void input_update(InputData *input_data, Window window)
 {
+	PROFILE_FUNCTION();
+
 	glfwPollEvents();
 
 	input_data->old_cursor_pos = input_data->cursor_pos;
@@ -483,6 +483,18 @@ mat4 mat4_mul(const mat4 a, const mat4 b)
 	return result;
 }
 
+vec4 mat4_mul_vec4(const mat4 a, vec4 v)
+{
+	vec4 result;
+	for (u32 i = 0; i < 4; i++) {
+		result.v[i] = a.M[i + 0 * 4] * v.x
+					+ a.M[i + 1 * 4] * v.y
+					+ a.M[i + 2 * 4] * v.z
+					+ a.M[i + 3 * 4] * v.w;
+	}
+	return result;
+}
+
 mat4 mat4_ortho(f32 left, f32 right, f32 bottom, f32 top, f32 near, f32 far)
 {
 	mat4 result = {
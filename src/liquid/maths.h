@@ -55,15 +55,17 @@ typedef struct
 	// const CoordTransform *parent;
 } Transform;
 
-// @TODO: Implement a proper hierarchy data type to enable tree traversal for relative transforms
-/*struct transform_hierarchy
+typedef struct
+{
+	vec3 min;
+	vec3 max;
+} AABB;
+
+typedef struct
 {
-	u32 transform_count = 0;
-	CoordTransform *transforms;
-	u32 *indices;
-	u32 *parents;
-	u32 *level;
-};*/
+	vec3 center;
+	f32 radius;
+} BoundingSphere;
 
 /* -- vec2 -- */
 
@@ -140,6 +142,7 @@ mat4 mat4_rotation_from_quat(quat q);
 mat4 mat4_scale(vec3 scale);
 
 mat4 mat4_mul(const mat4 a, const mat4 b);
+vec4 mat4_mul_vec4(const mat4 a, vec4 v);
 
 mat4 mat4_ortho(f32 left, f32 right, f32 bottom, f32 top, f32 near, f32 far);
 mat4 mat4_perspective(f32 fov, f32 aspect_ratio, f32 near, f32 far);
@@ -0,0 +1,446 @@
+#include "mesh_buffer.h"
+#include "gl_state.h"
+#include "resource_registry.h"
+
+#include <stdlib.h>
+#include <stddef.h>
+
+static MeshBuffer mesh_buffer;
+
+/* -- TLSF -- */
+
+static u32 tlsf_fls(u32 x)
+{
+	return 31 - __builtin_clz(x);
+}
+
+static u32 tlsf_ffs(u32 x)
+{
+	return __builtin_ctz(x);
+}
+
+static void tlsf_mapping(u32 size, u32 *fl, u32 *sl)
+{
+	if (size < TLSF_SL_COUNT) {
+		*fl = 0;
+		*sl = size;
+	} else {
+		u32 t = tlsf_fls(size);
+		*sl = (size >> (t - TLSF_SL_BITS)) ^ TLSF_SL_COUNT;
+		*fl = t - TLSF_SL_BITS + 1;
+	}
+}
+
+// Rounds the request up to the next list boundary, so that any block in the
+// list found for it is large enough
+static void tlsf_mapping_search(u32 size, u32 *fl, u32 *sl)
+{
+	if (size >= TLSF_SL_COUNT) {
+		size += (1u << (tlsf_fls(size) - TLSF_SL_BITS)) - 1;
+	}
+	tlsf_mapping(size, fl, sl);
+}
+
+static u32 tlsf_new_block(TLSFAllocator *tlsf)
+{
+	if (tlsf->unused_block != TLSF_NONE) {
+		u32 result = tlsf->unused_block;
+		tlsf->unused_block = tlsf->blocks[result].next_free;
+		return result;
+	}
+
+	if (tlsf->num_blocks == tlsf->blocks_capacity) {
+		tlsf->blocks_capacity = tlsf->blocks_capacity ? 2 * tlsf->blocks_capacity : 64;
+		tlsf->blocks = realloc(tlsf->blocks, tlsf->blocks_capacity * sizeof(TLSFBlock));
+	}
+	return tlsf->num_blocks++;
+}
+
+static void tlsf_release_block(TLSFAllocator *tlsf, u32 block)
+{
+	tlsf->blocks[block].next_free = tlsf->unused_block;
+	tlsf->unused_block = block;
+}
+
+static void tlsf_insert_free(TLSFAllocator *tlsf, u32 block)
+{
+	TLSFBlock *b = &tlsf->blocks[block];
+	u32 fl, sl;
+	tlsf_mapping(b->size, &fl, &sl);
+
+	b->free = true;
+	b->prev_free = TLSF_NONE;
+	b->next_free = tlsf->free_lists[fl][sl];
+	if (b->next_free != TLSF_NONE) {
+		tlsf->blocks[b->next_free].prev_free = block;
+	}
+	tlsf->free_lists[fl][sl] = block;
+
+	tlsf->fl_bitmap |= 1u << fl;
+	tlsf->sl_bitmap[fl] |= 1u << sl;
+}
+
+static void tlsf_remove_free(TLSFAllocator *tlsf, u32 block)
+{
+	TLSFBlock *b = &tlsf->blocks[block];
+	u32 fl, sl;
+	tlsf_mapping(b->size, &fl, &sl);
+
+	if (b->prev_free != TLSF_NONE) {
+		tlsf->blocks[b->prev_free].next_free = b->next_free;
+	} else {
+		tlsf->free_lists[fl][sl] = b->next_free;
+	}
+	if (b->next_free != TLSF_NONE) {
+		tlsf->blocks[b->next_free].prev_free = b->prev_free;
+	}
+
+	if (tlsf->free_lists[fl][sl] == TLSF_NONE) {
+		tlsf->sl_bitmap[fl] &= ~(1u << sl);
+		if (tlsf->sl_bitmap[fl] == 0) {
+			tlsf->fl_bitmap &= ~(1u << fl);
+		}
+	}
+
+	b->free = false;
+}
+
+static void tlsf_reset(TLSFAllocator *tlsf, u32 capacity)
+{
+	tlsf->capacity = capacity;
+	tlsf->used = 0;
+	tlsf->fl_bitmap = 0;
+	for (u32 i = 0; i < TLSF_FL_COUNT; i++) {
+		tlsf->sl_bitmap[i] = 0;
+		for (u32 j = 0; j < TLSF_SL_COUNT; j++) {
+			tlsf->free_lists[i][j] = TLSF_NONE;
+		}
+	}
+	tlsf->num_blocks = 0;
+	tlsf->unused_block = TLSF_NONE;
+
+	u32 block = tlsf_new_block(tlsf);
+	TLSFBlock *b = &tlsf->blocks[block];
+	b->offset = 0;
+	b->size = capacity;
+	b->prev_phys = TLSF_NONE;
+	b->next_phys = TLSF_NONE;
+	tlsf_insert_free(tlsf, block);
+	tlsf->last_block = block;
+}
+
+static u32 tlsf_alloc(TLSFAllocator *tlsf, u32 size)
+{
+	if (size == 0) {
+		size = 1;
+	}
+
+	u32 fl, sl;
+	tlsf_mapping_search(size, &fl, &sl);
+	if (fl >= TLSF_FL_COUNT) {
+		return TLSF_NONE;
+	}
+
+	u32 sl_map = tlsf->sl_bitmap[fl] & (~0u << sl);
+	if (sl_map == 0) {
+		u32 fl_map = fl + 1 < TLSF_FL_COUNT ? tlsf->fl_bitmap & (~0u << (fl + 1)) : 0;
+		if (fl_map == 0) {
+			return TLSF_NONE;
+		}
+		fl = tlsf_ffs(fl_map);
+		sl_map = tlsf->sl_bitmap[fl];
+	}
+	sl = tlsf_ffs(sl_map);
+
+	u32 block = tlsf->free_lists[fl][sl];
+	tlsf_remove_free(tlsf, block);
+
+	// Split off the remainder as a new free block
+	if (tlsf->blocks[block].size > size) {
+		u32 rest = tlsf_new_block(tlsf);
+		TLSFBlock *b = &tlsf->blocks[block];
+		TLSFBlock *r = &tlsf->blocks[rest];
+		r->offset = b->offset + size;
+		r->size = b->size - size;
+		r->prev_phys = block;
+		r->next_phys = b->next_phys;
+		if (r->next_phys != TLSF_NONE) {
+			tlsf->blocks[r->next_phys].prev_phys = rest;
+		} else {
+			tlsf->last_block = rest;
+		}
+		b->next_phys = rest;
+		b->size = size;
+		tlsf_insert_free(tlsf, rest);
+	}
+
+	tlsf->used += size;
+	return block;
+}
+
+static void tlsf_free(TLSFAllocator *tlsf, u32 block)
+{
+	tlsf->used -= tlsf->blocks[block].size;
+
+	u32 next = tlsf->blocks[block].next_phys;
+	if (next != TLSF_NONE && tlsf->blocks[next].free) {
+		tlsf_remove_free(tlsf, next);
+		tlsf->blocks[block].size += tlsf->blocks[next].size;
+		tlsf->blocks[block].next_phys = tlsf->blocks[next].next_phys;
+		if (tlsf->blocks[block].next_phys != TLSF_NONE) {
+			tlsf->blocks[tlsf->blocks[block].next_phys].prev_phys = block;
+		} else {
+			tlsf->last_block = block;
+		}
+		tlsf_release_block(tlsf, next);
+	}
+
+	u32 prev = tlsf->blocks[block].prev_phys;
+	if (prev != TLSF_NONE && tlsf->blocks[prev].free) {
+		tlsf_remove_free(tlsf, prev);
+		tlsf->blocks[prev].size += tlsf->blocks[block].size;
+		tlsf->blocks[prev].next_phys = tlsf->blocks[block].next_phys;
+		if (tlsf->blocks[prev].next_phys != TLSF_NONE) {
+			tlsf->blocks[tlsf->blocks[prev].next_phys].prev_phys = prev;
+		} else {
+			tlsf->last_block = prev;
+		}
+		tlsf_release_block(tlsf, block);
+		block = prev;
+	}
+
+	tlsf_insert_free(tlsf, block);
+}
+
+static void tlsf_grow(TLSFAllocator *tlsf, u32 capacity)
+{
+	u32 extra = capacity - tlsf->capacity;
+	u32 last = tlsf->last_block;
+
+	if (tlsf->blocks[last].free) {
+		tlsf_remove_free(tlsf, last);
+		tlsf->blocks[last].size += extra;
+		tlsf_insert_free(tlsf, last);
+	} else {
+		u32 block = tlsf_new_block(tlsf);
+		TLSFBlock *b = &tlsf->blocks[block];
+		b->offset = tlsf->capacity;
+		b->size = extra;
+		b->prev_phys = last;
+		b->next_phys = TLSF_NONE;
+		tlsf->blocks[last].next_phys = block;
+		tlsf->last_block = block;
+		tlsf_insert_free(tlsf, block);
+	}
+
+	tlsf->capacity = capacity;
+}
+
+/* -- Mesh buffer -- */
+
+void mesh_buffer_setup_vertex_array(GLuint vao)
+{
+	gl_state_bind_vertex_array(vao);
+	GL_CALL(glBindBuffer, GL_ARRAY_BUFFER, mesh_buffer.vbo);
+	GL_CALL(glEnableVertexAttribArray, 0);
+	GL_CALL(glEnableVertexAttribArray, 1);
+	GL_CALL(glEnableVertexAttribArray, 2);
+	GL_CALL(glVertexAttribPointer, 0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid *) offsetof(Vertex, pos));
+	GL_CALL(glVertexAttribPointer, 1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid *) offsetof(Vertex, uv));
+	GL_CALL(glVertexAttribPointer, 2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid *) offsetof(Vertex, normal));
+	gl_state_bind_element_buffer(mesh_buffer.ibo);
+}
+
+static GLuint create_buffer(GLenum target, size_t size)
+{
+	GLuint result;
+	GL_CALL(glGenBuffers, 1, &result);
+	GL_CALL(glBindBuffer, target, result);
+	GL_CALL(glBufferData, target, size, NULL, GL_STATIC_DRAW);
+	return result;
+}
+
+static void mesh_buffer_init()
+{
+	// No vertex array is bound here, so the element array target can not be used
+	mesh_buffer.vbo = create_buffer(GL_COPY_WRITE_BUFFER, MESH_BUFFER_INITIAL_VERTICES * sizeof(Vertex));
+	mesh_buffer.ibo = create_buffer(GL_COPY_WRITE_BUFFER, MESH_BUFFER_INITIAL_INDICES * sizeof(u32));
+	tlsf_reset(&mesh_buffer.vertices, MESH_BUFFER_INITIAL_VERTICES);
+	tlsf_reset(&mesh_buffer.indices, MESH_BUFFER_INITIAL_INDICES);
+
+	mesh_buffer.generation++;
+	mesh_buffer.initialized = true;
+
+	INFO("Created mesh buffer (%d vertices, %d indices).", MESH_BUFFER_INITIAL_VERTICES, MESH_BUFFER_INITIAL_INDICES);
+}
+
+// Moves the buffer into new storage of the given capacity. With compact set,
+// live ranges are packed to the front in slot order, otherwise they are copied
+// in place and the allocator is extended.
+static void relocate(bool vertices, u32 capacity, bool compact)
+{
+	TLSFAllocator *tlsf = vertices ? &mesh_buffer.vertices : &mesh_buffer.indices;
+	GLuint *buffer = vertices ? &mesh_buffer.vbo : &mesh_buffer.ibo;
+	size_t element_size = vertices ? sizeof(Vertex) : sizeof(u32);
+
+	// The element array binding belongs to a vertex array, so bind the copy target elsewhere
+	GLuint new_buffer = create_buffer(GL_COPY_WRITE_BUFFER, capacity * element_size);
+	GL_CALL(glBindBuffer, GL_COPY_READ_BUFFER, *buffer);
+
+	if (compact) {
+		tlsf_reset(tlsf, capacity);
+		for (u32 i = 0; i < mesh_buffer.num_slots; i++) {
+			MeshSlot *slot = &mesh_buffer.slots[i];
+			u32 *block = vertices ? &slot->vertex_block : &slot->index_block;
+			if (*block == TLSF_NONE) {
+				continue;
+			}
+
+			u32 old_offset = vertices ? (u32) slot->base_vertex : slot->first_index;
+			u32 size = vertices ? slot->num_vertices : slot->num_indices;
+
+			*block = tlsf_alloc(tlsf, size);
+			u32 new_offset = tlsf->blocks[*block].offset;
+			GL_CALL(glCopyBufferSubData, GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, old_offset * element_size, new_offset * element_size, size * element_size);
+
+			if (vertices) {
+				slot->base_vertex = (i32) new_offset;
+			} else {
+				slot->first_index = new_offset;
+			}
+		}
+	} else {
+		GL_CALL(glCopyBufferSubData, GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, tlsf->capacity * element_size);
+		tlsf_grow(tlsf, capacity);
+	}
+
+	GL_CALL(glDeleteBuffers, 1, buffer);
+	*buffer = new_buffer;
+	mesh_buffer.generation++;
+}
+
+static u32 alloc_range(bool vertices, u32 size)
+{
+	TLSFAllocator *tlsf = vertices ? &mesh_buffer.vertices : &mesh_buffer.indices;
+
+	u32 result = tlsf_alloc(tlsf, size);
+	if (result == TLSF_NONE && tlsf->capacity - tlsf->used >= size) {
+		// Enough space in total, but fragmented
+		relocate(vertices, tlsf->capacity, true);
+		result = tlsf_alloc(tlsf, size);
+	}
+
+	if (result == TLSF_NONE) {
+		u32 capacity = 2 * tlsf->capacity;
+		while (capacity - tlsf->used < 2 * size) {
+			capacity *= 2;
+		}
+		relocate(vertices, capacity, false);
+		result = tlsf_alloc(tlsf, size);
+		INFO("Grew mesh %s buffer to %d elements.", vertices ? "vertex" : "index", capacity);
+	}
+
+	return result;
+}
+
+Mesh mesh_buffer_upload(const Vertex *vertices, u32 num_vertices, const u32 *indices, u32 num_indices)
+{
+	if (!mesh_buffer.initialized) {
+		mesh_buffer_init();
+	}
+
+	u32 id;
+	if (mesh_buffer.num_free_slots) {
+		id = mesh_buffer.free_slots[--mesh_buffer.num_free_slots];
+	} else {
+		if (mesh_buffer.num_slots == mesh_buffer.slots_capacity) {
+			mesh_buffer.slots_capacity = mesh_buffer.slots_capacity ? 2 * mesh_buffer.slots_capacity : 64;
+			mesh_buffer.slots = realloc(mesh_buffer.slots, mesh_buffer.slots_capacity * sizeof(MeshSlot));
+			mesh_buffer.free_slots = realloc(mesh_buffer.free_slots, mesh_buffer.slots_capacity * sizeof(u32));
+		}
+		id = mesh_buffer.num_slots++;
+	}
+
+	MeshSlot *slot = &mesh_buffer.slots[id];
+	slot->num_vertices = num_vertices;
+	slot->num_indices = num_indices;
+	slot->vertex_block = TLSF_NONE;
+	slot->index_block = TLSF_NONE;
+
+	// Allocating may compact the buffer, which skips ranges that are not allocated yet
+	slot->vertex_block = alloc_range(true, num_vertices);
+	slot->base_vertex = (i32) mesh_buffer.vertices.blocks[slot->vertex_block].offset;
+	slot->index_block = alloc_range(false, num_indices);
+	slot->first_index = mesh_buffer.indices.blocks[slot->index_block].offset;
+
+	GL_CALL(glBindBuffer, GL_COPY_WRITE_BUFFER, mesh_buffer.vbo);
+	GL_CALL(glBufferSubData, GL_COPY_WRITE_BUFFER, slot->base_vertex * sizeof(Vertex), num_vertices * sizeof(Vertex), vertices);
+	GL_CALL(glBindBuffer, GL_COPY_WRITE_BUFFER, mesh_buffer.ibo);
+	GL_CALL(glBufferSubData, GL_COPY_WRITE_BUFFER, slot->first_index * sizeof(u32), num_indices * sizeof(u32), indices);
+
+	Mesh result = {};
+	result.id = id;
+	result.num_indices = num_indices;
+	return result;
+}
+
+void mesh_destroy(Mesh *mesh)
+{
+	MeshSlot *slot = &mesh_buffer.slots[mesh->id];
+	if (slot->vertex_block == TLSF_NONE) {
+		return;
+	}
+
+	resource_registry_remove(RESOURCE_MESH, mesh->id);
+	tlsf_free(&mesh_buffer.vertices, slot->vertex_block);
+	tlsf_free(&mesh_buffer.indices, slot->index_block);
+	slot->vertex_block = TLSF_NONE;
+	slot->index_block = TLSF_NONE;
+	mesh_buffer.free_slots[mesh_buffer.num_free_slots++] = mesh->id;
+
+	mesh->num_indices = 0;
+}
+
+void mesh_buffer_compact()
+{
+	if (mesh_buffer.initialized) {
+		relocate(true, mesh_buffer.vertices.capacity, true);
+		relocate(false, mesh_buffer.indices.capacity, true);
+		INFO("Compacted mesh buffer (%d vertices, %d indices in use).", mesh_buffer.vertices.used, mesh_buffer.indices.used);
+	}
+}
+
+void mesh_buffer_destroy()
+{
+	if (!mesh_buffer.initialized) {
+		return;
+	}
+
+	GL_CALL(glDeleteBuffers, 1, &mesh_buffer.vbo);
+	GL_CALL(glDeleteBuffers, 1, &mesh_buffer.ibo);
+
+	free(mesh_buffer.vertices.blocks);
+	free(mesh_buffer.indices.blocks);
+	free(mesh_buffer.slots);
+	free(mesh_buffer.free_slots);
+
+	// Vertex arrays set up for this generation must not match a new buffer
+	MeshBuffer empty = {};
+	empty.generation = mesh_buffer.generation;
+	mesh_buffer = empty;
+}
+
+u32 mesh_buffer_generation()
+{
+	return mesh_buffer.generation;
+}
+
+GLuint mesh_buffer_ibo()
+{
+	return mesh_buffer.ibo;
+}
+
+const MeshSlot *mesh_buffer_slot(Mesh mesh)
+{
+	return &mesh_buffer.slots[mesh.id];
+}
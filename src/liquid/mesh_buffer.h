@@ -0,0 +1,104 @@
+#pragma once
+
+#include "common.h"
+#include "maths.h"
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#define MESH_BUFFER_INITIAL_VERTICES (256 * 1024)
+#define MESH_BUFFER_INITIAL_INDICES (1024 * 1024)
+
+#define TLSF_SL_BITS 4
+#define TLSF_SL_COUNT (1 << TLSF_SL_BITS)
+#define TLSF_FL_COUNT 32
+#define TLSF_NONE 0xffffffff
+
+typedef struct
+{
+	vec3 pos;
+	vec2 uv;
+	vec3 normal;
+} Vertex;
+
+// A mesh is a slot in the shared mesh buffer. Where its vertices and indices
+// live is kept in the slot table, so the buffer can be compacted without
+// invalidating the Mesh values held by the application. The bounds are in
+// model space.
+typedef struct
+{
+	u32 id;
+	u32 num_indices;
+	AABB aabb;
+	BoundingSphere sphere;
+} Mesh;
+
+typedef struct
+{
+	u32 offset;
+	u32 size;
+	u32 prev_phys;
+	u32 next_phys;
+	u32 prev_free;
+	u32 next_free;
+	bool free;
+} TLSFBlock;
+
+// Two-level segregated fit allocator over a range of element units. Block
+// headers are kept out of band, since the memory being managed is on the GPU.
+typedef struct
+{
+	u32 capacity;
+	u32 used;
+
+	u32 fl_bitmap;
+	u32 sl_bitmap[TLSF_FL_COUNT];
+	u32 free_lists[TLSF_FL_COUNT][TLSF_SL_COUNT];
+
+	TLSFBlock *blocks;
+	u32 num_blocks;
+	u32 blocks_capacity;
+	u32 unused_block;
+	u32 last_block;
+} TLSFAllocator;
+
+typedef struct
+{
+	i32 base_vertex;
+	u32 first_index;
+	u32 num_indices;
+	u32 num_vertices;
+	u32 vertex_block;
+	u32 index_block;
+} MeshSlot;
+
+typedef struct
+{
+	bool initialized;
+
+	GLuint vbo;
+	GLuint ibo;
+	u32 generation; // Changes whenever vbo or ibo is replaced
+
+	TLSFAllocator vertices;
+	TLSFAllocator indices;
+
+	MeshSlot *slots;
+	u32 num_slots;
+	u32 slots_capacity;
+	u32 *free_slots;
+	u32 num_free_slots;
+} MeshBuffer;
+
+Mesh mesh_buffer_upload(const Vertex *vertices, u32 num_vertices, const u32 *indices, u32 num_indices);
+void mesh_destroy(Mesh *mesh);
+
+void mesh_buffer_compact();
+void mesh_buffer_destroy();
+
+// Vertex arrays can not be shared between contexts, so every context keeps its
+// own and sets it up again when the generation has changed
+void mesh_buffer_setup_vertex_array(GLuint vao);
+u32 mesh_buffer_generation();
+GLuint mesh_buffer_ibo();
+const MeshSlot *mesh_buffer_slot(Mesh mesh);
@@ -1,6 +1,8 @@
 #include "obj_loading.h"
 #include "common.h"
 #include "maths.h"
+#include "cpu_profiler.h"
+#include "resource_registry.h"
 
 #define OBJMODEL_INITIAL_VERTEX_CAPACITY 10000
 #define OBJMODEL_INITIAL_INDEX_CAPACITY 10000
@@ -14,13 +16,6 @@ typedef union
 	u32 arr[3];
 } OBJIndex;
 
-typedef struct
-{
-	vec3 pos;
-	vec2 uv;
-	vec3 normal;
-} Vertex;
-
 typedef struct
 {
 	vec3 *positions;
@@ -43,6 +38,9 @@ typedef struct
 	u32 *indices;
 	u32 num_vertices;
 	u32 num_indices;
+
+	AABB aabb;
+	BoundingSphere sphere;
 } IndexedModel;
 
 // static char *get_file_contents(const char *path)
@@ -78,6 +76,18 @@ static char *parse_vertex(char *line_start, u32 tag_len, u32 num_comps, f32 *des
 	return c;
 }
 
+// Counted ahead of parsing, so that the index array is grown enough first
+static u32 count_face_indices(const char *line_start)
+{
+	u32 result = 0;
+	for (const char *c = line_start + 1; *c && *c != '\n'; c++) {
+		if (!IS_WHITESPACE(*c) && IS_WHITESPACE(c[-1])) {
+			result++;
+		}
+	}
+	return result;
+}
+
 static u32 parse_face(char *line_start, OBJIndex *face_start, size_t num_indices, size_t num_positions, size_t num_uvs, size_t num_normals)
 {
 	char *index_start = line_start + 2; // Skip "f"
@@ -202,8 +212,11 @@ static RawOBJData parse_obj(char *text)
 				result.num_indices_in_face = (u32 *) realloc((void *) result.num_indices_in_face, face_capacity * sizeof(u32));
 			}
 
-			if (result.num_indices + result.num_indices_in_face[result.num_faces] >= index_capacity) {
-				index_capacity *= 2;
+			u32 face_size = count_face_indices(line_start);
+			if (result.num_indices + face_size > index_capacity) {
+				while (result.num_indices + face_size > index_capacity) {
+					index_capacity *= 2;
+				}
 				result.indices = (OBJIndex *) realloc((void *) result.indices, index_capacity * sizeof(OBJIndex));
 			}
 
@@ -251,6 +264,41 @@ static void calc_normals(IndexedModel model)
 	}
 }
 
+// The sphere is centered on the box, with the radius taken from the farthest
+// vertex rather than the box corners, which gives a tighter fit.
+static void calc_bounds(IndexedModel *model)
+{
+	if (model->num_vertices == 0) {
+		model->aabb.min = vec3_zero();
+		model->aabb.max = vec3_zero();
+		model->sphere.center = vec3_zero();
+		model->sphere.radius = 0.0f;
+		return;
+	}
+
+	vec3 min = model->vertices[0].pos;
+	vec3 max = model->vertices[0].pos;
+	for (u32 i = 1; i < model->num_vertices; i++) {
+		vec3 pos = model->vertices[i].pos;
+		for (u32 j = 0; j < 3; j++) {
+			if (pos.v[j] < min.v[j]) min.v[j] = pos.v[j];
+			if (pos.v[j] > max.v[j]) max.v[j] = pos.v[j];
+		}
+	}
+
+	vec3 center = vec3_scalar_mul(vec3_add(min, max), 0.5f);
+	f32 radius_squared = 0.0f;
+	for (u32 i = 0; i < model->num_vertices; i++) {
+		f32 d = vec3_mag_squared(vec3_sub(model->vertices[i].pos, center));
+		if (d > radius_squared) radius_squared = d;
+	}
+
+	model->aabb.min = min;
+	model->aabb.max = max;
+	model->sphere.center = center;
+	model->sphere.radius = sqrtf32(radius_squared);
+}
+
 static IndexedModel create_indexed_model(RawOBJData data)
 {
 	IndexedModel result;
@@ -299,49 +347,29 @@ static IndexedModel create_indexed_model(RawOBJData data)
 		calc_normals(result);
 	}
 
+	calc_bounds(&result);
+
 	return result;
 }
 
 static Mesh create_mesh(IndexedModel model)
 {
-	Mesh result;
-
-	GLuint vbo;
-
-	GL_CALL(glGenVertexArrays, 1, &result.vao);
-	GL_CALL(glBindVertexArray, result.vao);
-
-	GL_CALL(glGenBuffers, 1, &vbo);
-	GL_CALL(glGenBuffers, 1, &result.ibo);
-
-	GL_CALL(glBindBuffer, GL_ARRAY_BUFFER, vbo);
-	GL_CALL(glBufferData, GL_ARRAY_BUFFER, sizeof(Vertex) * model.num_vertices, model.vertices, GL_STATIC_DRAW);
-
-	GL_CALL(glBindBuffer, GL_ELEMENT_ARRAY_BUFFER, result.ibo);
-	GL_CALL(glBufferData, GL_ELEMENT_ARRAY_BUFFER, sizeof(u32) * model.num_indices, model.indices, GL_STATIC_DRAW);
-
-	GL_CALL(glEnableVertexAttribArray, 0);
-	GL_CALL(glEnableVertexAttribArray, 1);
-	GL_CALL(glEnableVertexAttribArray, 2);
-	GL_CALL(glVertexAttribPointer, 0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), NULL);
-	GL_CALL(glVertexAttribPointer, 1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid *) sizeof(vec3));
-	GL_CALL(glVertexAttribPointer, 2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid *) sizeof(vec3) + sizeof(vec2));
-
-	GL_CALL(glBindVertexArray, 0);
-	GL_CALL(glDeleteBuffers, 1, &vbo);
-
-	result.num_indices = model.num_indices;
-
+	Mesh result = mesh_buffer_upload(model.vertices, model.num_vertices, model.indices, model.num_indices);
+	result.aabb = model.aabb;
+	result.sphere = model.sphere;
 	return result;
 }
 
 Mesh obj_load_mesh(const char *path)
 {
+	PROFILE_FUNCTION();
+
 	char *text = get_file_contents(path);
 
 	RawOBJData raw_data = parse_obj(text);
 	IndexedModel model = create_indexed_model(raw_data);
 	Mesh result = create_mesh(model);
+	resource_registry_add(RESOURCE_MESH, result.id, path, 0.0f);
 
 	free(model.vertices);
 	free(model.indices);
@@ -0,0 +1,50 @@
+#include "resource_registry.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+	ResourceEntry *entries;
+	u32 capacity;
+} ResourceTable;
+
+static ResourceTable resource_tables[RESOURCE_NUM_KINDS];
+
+ResourceEntry *resource_registry_get(ResourceKind kind, u32 id)
+{
+	ResourceTable *table = &resource_tables[kind];
+	if (id >= table->capacity) {
+		u32 capacity = table->capacity ? table->capacity : 64;
+		while (capacity <= id) {
+			capacity *= 2;
+		}
+		table->entries = realloc(table->entries, capacity * sizeof(ResourceEntry));
+		memset(table->entries + table->capacity, 0, (capacity - table->capacity) * sizeof(ResourceEntry));
+		table->capacity = capacity;
+	}
+	return &table->entries[id];
+}
+
+void resource_registry_add(ResourceKind kind, u32 id, const char *path, f32 size)
+{
+	ResourceEntry *entry = resource_registry_get(kind, id);
+	free(entry->path);
+	entry->registered = true;
+	entry->path = strdup(path);
+	entry->size = size;
+	entry->capture_session = 0;
+}
+
+// GL reuses names, and the mesh buffer reuses slots, so ids are forgotten on destruction
+void resource_registry_remove(ResourceKind kind, u32 id)
+{
+	ResourceTable *table = &resource_tables[kind];
+	if (id >= table->capacity) {
+		return;
+	}
+
+	ResourceEntry *entry = &table->entries[id];
+	free(entry->path);
+	memset(entry, 0, sizeof(ResourceEntry));
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "common.h"
+
+typedef enum
+{
+	RESOURCE_MESH,
+	RESOURCE_TEXTURE,
+	RESOURCE_FONT,
+	RESOURCE_NUM_KINDS,
+} ResourceKind;
+
+typedef struct
+{
+	bool registered;
+	char *path; // NULL for resources that were not loaded from a file
+	f32 size; // Font size
+	u32 capture_session; // Last command capture that wrote this resource out
+} ResourceEntry;
+
+// Remembers which file every loaded resource came from, keyed by the id the
+// renderer knows it by (mesh id, GL texture name, font texture name), so a
+// captured command stream can name its resources. Mesh ids and GL names are
+// small and dense, so each kind is a plain array indexed by id.
+// Not thread-safe; loading happens on one thread.
+void resource_registry_add(ResourceKind kind, u32 id, const char *path, f32 size);
+void resource_registry_remove(ResourceKind kind, u32 id);
+
+// Creates an unregistered entry if there is none, never returns NULL
+ResourceEntry *resource_registry_get(ResourceKind kind, u32 id);
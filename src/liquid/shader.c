@@ -1,7 +1,13 @@
 #include "shader.h"
+#include "gl_state.h"
+#include "cpu_profiler.h"
 
-#define BASIC_VSHADER_SOURCE "														\
-	#version 330 core 																\
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define BASIC_VSHADER_SOURCE "#version 330 core\n"												\
+"														\
 																					\
 	layout(location = 0) in vec3 vertex_pos;										\
 	layout(location = 1) in vec2 vertex_uv;											\
@@ -21,8 +27,8 @@
 	}																				\
 "
 
-#define BASIC_FSHADER_SOURCE "													\
-	#version 330 core 															\
+#define BASIC_FSHADER_SOURCE "#version 330 core\n"											\
+"													\
 																				\
 	in vec2 uv;																	\
 	in vec3 normal;																\
@@ -40,47 +46,247 @@
 	}																			\
 "
 
-#define TEXT_VSHADER_SOURCE "														\
-	#version 330 core 																\
+#define BASIC_INSTANCED_VSHADER_SOURCE "#version 330 core\n"										\
+"												\
 																					\
-	layout(location = 0) in vec2 vertex_pos;										\
+	layout(location = 0) in vec3 vertex_pos;										\
 	layout(location = 1) in vec2 vertex_uv;											\
+	layout(location = 2) in vec3 vertex_normal;										\
+	layout(location = 3) in mat4 instance_transformation;							\
+	layout(location = 7) in vec4 instance_color;									\
 																					\
 	out vec2 uv;																	\
+	out vec3 normal;																\
+	out vec4 color;																	\
 																					\
 	uniform mat4 view_projection;													\
-	uniform mat4 transformation;													\
 																					\
 	void main()																		\
 	{																				\
 		uv = vertex_uv;																\
-		gl_Position = view_projection * transformation * vec4(vertex_pos, 0.0, 1.0);\
+		normal = (instance_transformation * vec4(vertex_normal, 0.0)).xyz;			\
+		color = instance_color;														\
+		gl_Position = view_projection * instance_transformation * vec4(vertex_pos, 1.0);\
+	}																				\
+"
+
+#define BASIC_INSTANCED_FSHADER_SOURCE "#version 330 core\n"									\
+"											\
+																				\
+	in vec2 uv;																	\
+	in vec3 normal;																\
+	in vec4 color;																\
+																				\
+	out vec4 frag_color;														\
+																				\
+	uniform sampler2D diffuse;													\
+																				\
+	const vec3 light_dir = normalize(vec3(1, 0, -1));							\
+																				\
+	void main()																	\
+	{																			\
+		frag_color = dot(-light_dir, normal) * (texture(diffuse, uv) + color);	\
+	}																			\
+"
+
+#define BASIC_INDIRECT_VSHADER_SOURCE "#version 400 core\n"										\
+"#extension GL_ARB_shader_storage_buffer_object : require\n"						\
+"#extension GL_ARB_shading_language_420pack : require\n"							\
+"																					\
+	layout(location = 0) in vec3 vertex_pos;										\
+	layout(location = 1) in vec2 vertex_uv;											\
+	layout(location = 2) in vec3 vertex_normal;										\
+	layout(location = 8) in uint draw_id;											\
+																					\
+	struct DrawItem																	\
+	{																				\
+		mat4 transformation;														\
+		vec4 color;																	\
+	};																				\
+																					\
+	layout(std430, binding = 0) readonly buffer DrawItems							\
+	{																				\
+		DrawItem items[];															\
+	};																				\
+																					\
+	out vec2 uv;																	\
+	out vec3 normal;																\
+	out vec4 color;																	\
+																					\
+	uniform mat4 view_projection;													\
+																					\
+	void main()																		\
+	{																				\
+		mat4 transformation = items[draw_id].transformation;						\
+		uv = vertex_uv;																\
+		normal = (transformation * vec4(vertex_normal, 0.0)).xyz;					\
+		color = items[draw_id].color;												\
+		gl_Position = view_projection * transformation * vec4(vertex_pos, 1.0);		\
+	}																				\
+"
+
+#define SPRITE_VSHADER_SOURCE "#version 330 core\n"											\
+"													\
+																					\
+	layout(location = 0) in vec4 vertex_pos;										\
+	layout(location = 1) in vec2 vertex_uv;											\
+	layout(location = 2) in vec4 vertex_color;										\
+																					\
+	out vec2 uv;																	\
+	out vec4 color;																	\
+																					\
+	void main()																		\
+	{																				\
+		uv = vertex_uv;																\
+		color = vertex_color;														\
+		gl_Position = vertex_pos;													\
 	}																				\
 "
 
-#define TEXT_FSHADER_SOURCE "									\
-	#version 330 core 											\
+#define SPRITE_FSHADER_SOURCE "#version 330 core\n"											\
+"													\
+																				\
+	in vec2 uv;																	\
+	in vec4 color;																\
+																				\
+	out vec4 frag_color;														\
+																				\
+	uniform sampler2D diffuse;													\
+																				\
+	void main()																	\
+	{																			\
+		frag_color = texture(diffuse, uv) + color;								\
+	}																			\
+"
+
+#define TEXT_FSHADER_SOURCE "#version 330 core\n"							\
+"									\
 																\
 	in vec2 uv;													\
+	in vec4 color;												\
 																\
 	out vec4 frag_color;										\
 																\
 	uniform sampler2D diffuse;									\
-	uniform vec4 color;											\
-																\
 																\
 	void main()													\
 	{															\
-		frag_color = vec4(1, 1, 1, 1) * texture(diffuse, uv).r; \
+		frag_color = color * texture(diffuse, uv).r;			\
 	}															\
 "
 
-static struct
+// Uniform values belong to the program, which is shared between contexts, so
+// every thread drawing with a context of its own loads its own default shaders
+static _Thread_local struct
 {
 	Shader basic;
+	Shader basic_instanced;
+	Shader basic_indirect;
+	Shader sprite;
 	Shader text;
 } default_shaders;
 
+typedef struct
+{
+	u32 hash;
+	GLint location;
+	char name[SHADER_UNIFORM_NAME_LENGTH];
+} UniformEntry;
+
+// Active uniforms of one program, stored in an open-addressed table keyed by
+// the FNV-1a hash of the uniform name.
+typedef struct
+{
+	Shader program;
+	u32 capacity;
+	UniformEntry *entries;
+} UniformTable;
+
+static UniformTable uniform_tables[SHADER_MAX_PROGRAMS];
+static pthread_mutex_t uniform_tables_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static u32 hash_uniform_name(const char *name)
+{
+	u32 result = 2166136261u;
+	while (*name) {
+		result ^= (u8) *name++;
+		result *= 16777619u;
+	}
+	return result;
+}
+
+static UniformTable *find_uniform_table(Shader program)
+{
+	for (u32 i = 0; i < SHADER_MAX_PROGRAMS; i++) {
+		if (uniform_tables[i].program == program) {
+			return &uniform_tables[i];
+		}
+	}
+	return NULL;
+}
+
+static void reflect_uniforms(Shader program)
+{
+	pthread_mutex_lock(&uniform_tables_mutex);
+	UniformTable *table = find_uniform_table(0);
+	if (table == NULL) {
+		pthread_mutex_unlock(&uniform_tables_mutex);
+		ERROR("Cannot reflect uniforms of program %d, more than %d programs are alive.", program, SHADER_MAX_PROGRAMS);
+		return;
+	}
+
+	GLint num_uniforms;
+	GL_CALL(glGetProgramiv, program, GL_ACTIVE_UNIFORMS, &num_uniforms);
+
+	// Keep the load factor at or below one half
+	u32 capacity = 8;
+	while (capacity < 2 * (u32) num_uniforms) {
+		capacity *= 2;
+	}
+
+	table->program = program;
+	table->capacity = capacity;
+	table->entries = calloc(capacity, sizeof(UniformEntry));
+
+	for (GLint i = 0; i < num_uniforms; i++) {
+		char name[SHADER_UNIFORM_NAME_LENGTH];
+		GLsizei length;
+		GLint size;
+		GLenum type;
+		GL_CALL(glGetActiveUniform, program, i, SHADER_UNIFORM_NAME_LENGTH, &length, &size, &type, name);
+
+		// Arrays are reported as "name[0]", but are looked up by their plain name
+		char *bracket = strchr(name, '[');
+		if (bracket) {
+			*bracket = 0;
+		}
+
+		u32 hash = hash_uniform_name(name);
+		u32 slot = hash & (capacity - 1);
+		while (table->entries[slot].name[0]) {
+			slot = (slot + 1) & (capacity - 1);
+		}
+
+		table->entries[slot].hash = hash;
+		table->entries[slot].location = glGetUniformLocation(program, name);
+		strcpy(table->entries[slot].name, name);
+	}
+	pthread_mutex_unlock(&uniform_tables_mutex);
+}
+
+static void release_uniforms(Shader program)
+{
+	pthread_mutex_lock(&uniform_tables_mutex);
+	UniformTable *table = find_uniform_table(program);
+	if (table) {
+		free(table->entries);
+		table->entries = NULL;
+		table->capacity = 0;
+		table->program = 0;
+	}
+	pthread_mutex_unlock(&uniform_tables_mutex);
+}
+
 static char *load_source_from_file(const char *path)
 {
 	FILE *file = fopen(path, "rb");
@@ -102,7 +308,9 @@ static char *load_source_from_file(const char *path)
 
 static Shader shader_create(char *vsource, char *fsource, const char *vname, const char *fname)
 {
-	static char shader_info_log[1024];
+	PROFILE_FUNCTION();
+
+	char shader_info_log[1024];
 	
 	i32 success;
 	GLuint vshader, fshader;
@@ -147,6 +355,8 @@ static Shader shader_create(char *vsource, char *fsource, const char *vname, con
 	GL_CALL(glDeleteShader, vshader);
 	GL_CALL(glDeleteShader, fshader);
 
+	reflect_uniforms(result);
+
 	INFO("Created Shader (vs: %s, fs: %s, program: %d).", vname, fname, result);
 
 	return result;
@@ -167,24 +377,94 @@ Shader shader_load(const char *vpath, const char *fpath)
 
 void shader_destroy(Shader *shader)
 {
+	release_uniforms(*shader);
+	gl_state_forget_program(*shader);
 	GL_CALL(glDeleteProgram, *shader);
 }
 
 void shader_bind(Shader shader)
 {
-	GL_CALL(glUseProgram, shader);
+	gl_state_use_program(shader);
+}
+
+// Shaders may be created on several render threads at once, so the tables are
+// only touched under a lock
+Uniform shader_get_uniform(Shader shader, const char *name)
+{
+	Uniform result = UNIFORM_INVALID;
+
+	pthread_mutex_lock(&uniform_tables_mutex);
+	UniformTable *table = find_uniform_table(shader);
+	if (table && table->capacity) {
+		u32 hash = hash_uniform_name(name);
+		u32 slot = hash & (table->capacity - 1);
+		while (table->entries[slot].name[0]) {
+			UniformEntry *entry = &table->entries[slot];
+			if (entry->hash == hash && strcmp(entry->name, name) == 0) {
+				result = entry->location;
+				break;
+			}
+			slot = (slot + 1) & (table->capacity - 1);
+		}
+	}
+	pthread_mutex_unlock(&uniform_tables_mutex);
+
+	return result;
+}
+
+void shader_set_int(Uniform uniform, i32 value)
+{
+	GL_CALL(glUniform1i, uniform, value);
+}
+
+void shader_set_float(Uniform uniform, f32 value)
+{
+	GL_CALL(glUniform1f, uniform, value);
+}
+
+void shader_set_vec2(Uniform uniform, vec2 value)
+{
+	GL_CALL(glUniform2f, uniform, value.x, value.y);
+}
+
+void shader_set_vec3(Uniform uniform, vec3 value)
+{
+	GL_CALL(glUniform3f, uniform, value.x, value.y, value.z);
+}
+
+void shader_set_vec4(Uniform uniform, vec4 value)
+{
+	GL_CALL(glUniform4f, uniform, value.x, value.y, value.z, value.w);
+}
+
+void shader_set_mat4(Uniform uniform, const mat4 *value)
+{
+	GL_CALL(glUniformMatrix4fv, uniform, 1, GL_FALSE, value->M);
 }
 
 void shader_load_defaults()
 {
 	default_shaders.basic = shader_create(BASIC_VSHADER_SOURCE, BASIC_FSHADER_SOURCE, "basic_vs", "basic_fs");
-	default_shaders.text = shader_create(TEXT_VSHADER_SOURCE, TEXT_FSHADER_SOURCE, "text_vs", "text_fs");
+	default_shaders.basic_instanced = shader_create(BASIC_INSTANCED_VSHADER_SOURCE, BASIC_INSTANCED_FSHADER_SOURCE, "basic_instanced_vs", "basic_instanced_fs");
+	// draw_id comes from the base instance of every indirect command, and the
+	// storage buffer's binding is set in the shader
+	if (GLEW_ARB_multi_draw_indirect && GLEW_ARB_shader_storage_buffer_object
+		&& GLEW_ARB_base_instance && GLEW_ARB_shading_language_420pack) {
+		default_shaders.basic_indirect = shader_create(BASIC_INDIRECT_VSHADER_SOURCE, BASIC_INSTANCED_FSHADER_SOURCE, "basic_indirect_vs", "basic_instanced_fs");
+	}
+	default_shaders.sprite = shader_create(SPRITE_VSHADER_SOURCE, SPRITE_FSHADER_SOURCE, "sprite_vs", "sprite_fs");
+	default_shaders.text = shader_create(SPRITE_VSHADER_SOURCE, TEXT_FSHADER_SOURCE, "sprite_vs", "text_fs");
 	INFO("Loaded default shaders.");
 }
 
 void shader_destroy_defaults()
 {
 	shader_destroy(&default_shaders.basic);
+	shader_destroy(&default_shaders.basic_instanced);
+	if (default_shaders.basic_indirect) {
+		shader_destroy(&default_shaders.basic_indirect);
+	}
+	shader_destroy(&default_shaders.sprite);
 	shader_destroy(&default_shaders.text);
 	INFO("Destroyed default shaders.");
 }
@@ -194,6 +474,22 @@ Shader shader_get_basic()
 	return default_shaders.basic;
 }
 
+Shader shader_get_basic_instanced()
+{
+	return default_shaders.basic_instanced;
+}
+
+// Zero if the driver lacks multi-draw indirect or shader storage buffers
+Shader shader_get_basic_indirect()
+{
+	return default_shaders.basic_indirect;
+}
+
+Shader shader_get_sprite()
+{
+	return default_shaders.sprite;
+}
+
 Shader shader_get_text()
 {
 	return default_shaders.text;
@@ -1,19 +1,40 @@
 #pragma once
 
 #include "common.h"
+#include "maths.h"
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
+#define SHADER_MAX_PROGRAMS 64
+#define SHADER_UNIFORM_NAME_LENGTH 64
+#define UNIFORM_INVALID -1
+
 typedef GLuint Shader;
 
+// A resolved uniform location. Look it up once with shader_get_uniform and pass
+// it to the typed setters; the setters act on the currently bound shader.
+typedef GLint Uniform;
+
 Shader shader_load(const char *vpath, const char *fpath);
 void shader_destroy(Shader *shader);
 void shader_bind(Shader shader);
 
+Uniform shader_get_uniform(Shader shader, const char *name);
+
+void shader_set_int(Uniform uniform, i32 value);
+void shader_set_float(Uniform uniform, f32 value);
+void shader_set_vec2(Uniform uniform, vec2 value);
+void shader_set_vec3(Uniform uniform, vec3 value);
+void shader_set_vec4(Uniform uniform, vec4 value);
+void shader_set_mat4(Uniform uniform, const mat4 *value);
+
 // @TODO: get rid of this
 void shader_load_defaults();
 void shader_destroy_defaults();
 
 Shader shader_get_basic();
+Shader shader_get_basic_instanced();
+Shader shader_get_basic_indirect();
+Shader shader_get_sprite();
 Shader shader_get_text();
\ No newline at end of file
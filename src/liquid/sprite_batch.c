@@ -0,0 +1,165 @@
+#include "sprite_batch.h"
+#include "gl_state.h"
+
+#include <stddef.h>
+
+#if defined(__SSE__)
+	#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+	#include <arm_neon.h>
+#endif
+
+static const vec2 rect_corners[] = {
+	{{-1.0f, -1.0f}}, {{-1.0f,  1.0f}}, {{ 1.0f, -1.0f}},
+	{{ 1.0f, -1.0f}}, {{-1.0f,  1.0f}}, {{ 1.0f,  1.0f}}
+};
+
+static const vec2 rect_uvs[] = {
+	{{0.0f, 0.0f}}, {{0.0f, 1.0f}}, {{1.0f, 0.0f}},
+	{{1.0f, 0.0f}}, {{0.0f, 1.0f}}, {{1.0f, 1.0f}}
+};
+
+static const vec2 triangle_corners[] = {
+	{{-1.0f, -1.0f}}, {{1.0f, -1.0f}}, {{0.0f, 1.0f}}
+};
+
+static const vec2 triangle_uvs[] = {
+	{{0.0f, 0.0f}}, {{0.5f, 1.0f}}, {{1.0f, 0.0f}}
+};
+
+void sprite_batch_init(SpriteBatch *batch, StreamBuffer *stream)
+{
+	batch->stream = stream;
+	batch->vertices = NULL;
+	batch->num_vertices = 0;
+	batch->shader = 0;
+	batch->texture = 0;
+	batch->draw_calls = 0;
+
+	GL_CALL(glGenVertexArrays, 1, &batch->vao);
+	gl_state_bind_vertex_array(batch->vao);
+	GL_CALL(glBindBuffer, GL_ARRAY_BUFFER, stream->buffer);
+	GL_CALL(glEnableVertexAttribArray, 0);
+	GL_CALL(glEnableVertexAttribArray, 1);
+	GL_CALL(glEnableVertexAttribArray, 2);
+	GL_CALL(glVertexAttribPointer, 0, 4, GL_FLOAT, GL_FALSE, sizeof(SpriteVertex), (const GLvoid *) offsetof(SpriteVertex, pos));
+	GL_CALL(glVertexAttribPointer, 1, 2, GL_FLOAT, GL_FALSE, sizeof(SpriteVertex), (const GLvoid *) offsetof(SpriteVertex, uv));
+	GL_CALL(glVertexAttribPointer, 2, 4, GL_FLOAT, GL_FALSE, sizeof(SpriteVertex), (const GLvoid *) offsetof(SpriteVertex, color));
+	gl_state_bind_vertex_array(0);
+}
+
+void sprite_batch_destroy(SpriteBatch *batch)
+{
+	gl_state_forget_vertex_array(batch->vao);
+	GL_CALL(glDeleteVertexArrays, 1, &batch->vao);
+	batch->vertices = NULL;
+	batch->num_vertices = 0;
+}
+
+void sprite_batch_flush(SpriteBatch *batch)
+{
+	if (batch->vertices == NULL) {
+		return;
+	}
+
+	u32 count = batch->num_vertices;
+	stream_buffer_commit(batch->stream, &batch->allocation, count * sizeof(SpriteVertex));
+	batch->vertices = NULL;
+	batch->num_vertices = 0;
+
+	if (count == 0) {
+		return;
+	}
+
+	// Batch shaders sample from unit 0, which is what sampler uniforms default to
+	shader_bind(batch->shader);
+	gl_state_bind_texture(0, batch->texture);
+
+	// Allocations are aligned to the vertex size, so the offset is a whole vertex index
+	gl_state_bind_vertex_array(batch->vao);
+	GL_CALL(glDrawArrays, GL_TRIANGLES, batch->allocation.offset / sizeof(SpriteVertex), count);
+
+	batch->draw_calls++;
+}
+
+// Writes clip-space positions mvp * (x, y, 0, 1) for each corner. Only the first,
+// second and fourth columns of the matrix contribute, since z is zero and w is one.
+static void transform_corners(SpriteVertex *dest, const mat4 *mvp, const vec2 *corners, const vec2 *uvs, u32 count, vec4 color)
+{
+#if defined(__SSE__)
+	__m128 c0 = _mm_loadu_ps(&mvp->M[0]);
+	__m128 c1 = _mm_loadu_ps(&mvp->M[4]);
+	__m128 c3 = _mm_loadu_ps(&mvp->M[12]);
+	for (u32 i = 0; i < count; i++) {
+		__m128 pos = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(corners[i].x)),
+										   _mm_mul_ps(c1, _mm_set1_ps(corners[i].y))), c3);
+		_mm_storeu_ps(dest[i].pos.v, pos);
+		dest[i].uv = uvs[i];
+		dest[i].color = color;
+	}
+#elif defined(__ARM_NEON)
+	float32x4_t c0 = vld1q_f32(&mvp->M[0]);
+	float32x4_t c1 = vld1q_f32(&mvp->M[4]);
+	float32x4_t c3 = vld1q_f32(&mvp->M[12]);
+	for (u32 i = 0; i < count; i++) {
+		float32x4_t pos = vmlaq_n_f32(vmlaq_n_f32(c3, c0, corners[i].x), c1, corners[i].y);
+		vst1q_f32(dest[i].pos.v, pos);
+		dest[i].uv = uvs[i];
+		dest[i].color = color;
+	}
+#else
+	for (u32 i = 0; i < count; i++) {
+		for (u32 j = 0; j < 4; j++) {
+			dest[i].pos.v[j] = mvp->M[j] * corners[i].x + mvp->M[4 + j] * corners[i].y + mvp->M[12 + j];
+		}
+		dest[i].uv = uvs[i];
+		dest[i].color = color;
+	}
+#endif
+}
+
+static SpriteVertex *reserve_vertices(SpriteBatch *batch, Shader shader, GLuint texture, u32 count)
+{
+	if (shader != batch->shader || texture != batch->texture || batch->num_vertices + count > SPRITE_BATCH_MAX_VERTICES) {
+		sprite_batch_flush(batch);
+		batch->shader = shader;
+		batch->texture = texture;
+	}
+
+	if (batch->vertices == NULL) {
+		batch->allocation = stream_buffer_alloc(batch->stream, SPRITE_BATCH_MAX_VERTICES * sizeof(SpriteVertex), sizeof(SpriteVertex));
+		batch->vertices = batch->allocation.ptr;
+	}
+
+	SpriteVertex *result = batch->vertices + batch->num_vertices;
+	batch->num_vertices += count;
+	return result;
+}
+
+void sprite_batch_push_rect(SpriteBatch *batch, const mat4 *mvp, Shader shader, GLuint texture, vec4 color)
+{
+	SpriteVertex *dest = reserve_vertices(batch, shader, texture, 6);
+	transform_corners(dest, mvp, rect_corners, rect_uvs, 6, color);
+}
+
+void sprite_batch_push_triangle(SpriteBatch *batch, const mat4 *mvp, Shader shader, GLuint texture, vec4 color)
+{
+	SpriteVertex *dest = reserve_vertices(batch, shader, texture, 3);
+	transform_corners(dest, mvp, triangle_corners, triangle_uvs, 3, color);
+}
+
+void sprite_batch_push_quad(SpriteBatch *batch, const mat4 *mvp, Shader shader, GLuint texture, vec2 min, vec2 max, vec2 uv_min, vec2 uv_max, vec4 color)
+{
+	vec2 corners[] = {
+		{{min.x, max.y}}, {{max.x, max.y}}, {{min.x, min.y}},
+		{{min.x, min.y}}, {{max.x, max.y}}, {{max.x, min.y}}
+	};
+
+	vec2 uvs[] = {
+		{{uv_min.x, uv_max.y}}, {{uv_max.x, uv_max.y}}, {{uv_min.x, uv_min.y}},
+		{{uv_min.x, uv_min.y}}, {{uv_max.x, uv_max.y}}, {{uv_max.x, uv_min.y}}
+	};
+
+	SpriteVertex *dest = reserve_vertices(batch, shader, texture, 6);
+	transform_corners(dest, mvp, corners, uvs, 6, color);
+}
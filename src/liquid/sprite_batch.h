@@ -0,0 +1,42 @@
+#pragma once
+
+#include "common.h"
+#include "maths.h"
+#include "shader.h"
+#include "stream_buffer.h"
+
+#define SPRITE_BATCH_MAX_VERTICES (6 * 4096)
+
+typedef struct
+{
+	vec4 pos;
+	vec2 uv;
+	vec4 color;
+} SpriteVertex;
+
+// Collects rects, triangles and glyphs, already transformed to clip space on
+// the CPU, into one vertex buffer. A draw call is only issued when the texture
+// or the shader changes, the buffer is full, or the batch is flushed explicitly.
+// Vertices are written straight into an allocation from the stream buffer,
+// which stays open until the next flush.
+typedef struct
+{
+	GLuint vao;
+	StreamBuffer *stream;
+	StreamAllocation allocation;
+	SpriteVertex *vertices;
+	u32 num_vertices;
+
+	Shader shader;
+	GLuint texture;
+
+	u32 draw_calls;
+} SpriteBatch;
+
+void sprite_batch_init(SpriteBatch *batch, StreamBuffer *stream);
+void sprite_batch_destroy(SpriteBatch *batch);
+
+void sprite_batch_push_rect(SpriteBatch *batch, const mat4 *mvp, Shader shader, GLuint texture, vec4 color);
+void sprite_batch_push_triangle(SpriteBatch *batch, const mat4 *mvp, Shader shader, GLuint texture, vec4 color);
+void sprite_batch_push_quad(SpriteBatch *batch, const mat4 *mvp, Shader shader, GLuint texture, vec2 min, vec2 max, vec2 uv_min, vec2 uv_max, vec4 color);
+void sprite_batch_flush(SpriteBatch *batch);
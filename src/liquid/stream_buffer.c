@@ -0,0 +1,161 @@
+#include "stream_buffer.h"
+
+#define STREAM_BUFFER_FLAGS (GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT)
+
+void stream_buffer_init(StreamBuffer *stream, size_t size)
+{
+	stream->size = size ? size : STREAM_BUFFER_DEFAULT_SIZE;
+	stream->persistent = GLEW_ARB_buffer_storage;
+	stream->mapped = NULL;
+	stream->head = 0;
+	stream->frame = 0;
+	stream->stalls = 0;
+	for (u32 i = 0; i < STREAM_BUFFER_FRAMES_IN_FLIGHT; i++) {
+		stream->fences[i] = NULL;
+	}
+
+	GL_CALL(glGenBuffers, 1, &stream->buffer);
+	GL_CALL(glBindBuffer, GL_ARRAY_BUFFER, stream->buffer);
+
+	if (stream->persistent) {
+		GL_CALL(glBufferStorage, GL_ARRAY_BUFFER, stream->size, NULL, STREAM_BUFFER_FLAGS);
+		stream->mapped = glMapBufferRange(GL_ARRAY_BUFFER, 0, stream->size, STREAM_BUFFER_FLAGS);
+		if (stream->mapped == NULL) {
+			FATAL("Failed to persistently map the stream buffer.");
+		}
+
+		// Frame n writes into region n % STREAM_BUFFER_FRAMES_IN_FLIGHT
+		stream->region_start = 0;
+		stream->region_end = stream->size / STREAM_BUFFER_FRAMES_IN_FLIGHT;
+		INFO("Created persistently mapped stream buffer (%zu bytes).", stream->size);
+	} else {
+		GL_CALL(glBufferData, GL_ARRAY_BUFFER, stream->size, NULL, GL_STREAM_DRAW);
+		stream->region_start = 0;
+		stream->region_end = stream->size;
+		INFO("GL_ARB_buffer_storage is not available, stream buffer falls back to orphaning.");
+	}
+
+	stream->head = stream->region_start;
+}
+
+void stream_buffer_destroy(StreamBuffer *stream)
+{
+	for (u32 i = 0; i < STREAM_BUFFER_FRAMES_IN_FLIGHT; i++) {
+		if (stream->fences[i]) {
+			glDeleteSync(stream->fences[i]);
+			stream->fences[i] = NULL;
+		}
+	}
+
+	if (stream->persistent) {
+		GL_CALL(glBindBuffer, GL_ARRAY_BUFFER, stream->buffer);
+		GL_CALL(glUnmapBuffer, GL_ARRAY_BUFFER);
+		stream->mapped = NULL;
+	}
+	GL_CALL(glDeleteBuffers, 1, &stream->buffer);
+}
+
+static void wait_for_fence(StreamBuffer *stream, u32 region)
+{
+	GLsync fence = stream->fences[region];
+	if (fence == NULL) {
+		return;
+	}
+
+	GLenum status = glClientWaitSync(fence, 0, 0);
+	if (status == GL_TIMEOUT_EXPIRED) {
+		stream->stalls++;
+		do {
+			status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+		} while (status == GL_TIMEOUT_EXPIRED);
+	}
+
+	glDeleteSync(fence);
+	stream->fences[region] = NULL;
+}
+
+void stream_buffer_begin_frame(StreamBuffer *stream)
+{
+	if (stream->persistent) {
+		u32 region = stream->frame % STREAM_BUFFER_FRAMES_IN_FLIGHT;
+		size_t region_size = stream->size / STREAM_BUFFER_FRAMES_IN_FLIGHT;
+
+		wait_for_fence(stream, region);
+		stream->region_start = region * region_size;
+		stream->region_end = stream->region_start + region_size;
+		stream->head = stream->region_start;
+	}
+}
+
+void stream_buffer_end_frame(StreamBuffer *stream)
+{
+	if (stream->persistent) {
+		u32 region = stream->frame % STREAM_BUFFER_FRAMES_IN_FLIGHT;
+		stream->fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+	stream->frame++;
+}
+
+StreamAllocation stream_buffer_alloc(StreamBuffer *stream, size_t size, size_t alignment)
+{
+	StreamAllocation result;
+
+	size_t offset = (stream->head + alignment - 1) / alignment * alignment;
+	if (offset + size > stream->region_end) {
+		if (stream->region_start + size > stream->region_end) {
+			FATAL("Stream allocation of %zu bytes does not fit into the stream buffer.", size);
+		}
+
+		if (stream->persistent) {
+			// This frame used up its region. Wait until the GPU consumed everything
+			// written so far and start over, instead of touching the other frames' regions.
+			WARN("Stream buffer region exhausted, stalling. Consider a larger stream buffer.");
+			GL_CALL(glFinish);
+			stream->stalls++;
+		} else {
+			GL_CALL(glBindBuffer, GL_ARRAY_BUFFER, stream->buffer);
+			GL_CALL(glBufferData, GL_ARRAY_BUFFER, stream->size, NULL, GL_STREAM_DRAW);
+		}
+		offset = (stream->region_start + alignment - 1) / alignment * alignment;
+	}
+
+	result.offset = offset;
+	result.size = size;
+
+	if (stream->persistent) {
+		result.ptr = stream->mapped + offset;
+	} else {
+		GL_CALL(glBindBuffer, GL_ARRAY_BUFFER, stream->buffer);
+		result.ptr = glMapBufferRange(GL_ARRAY_BUFFER, offset, size,
+									  GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_FLUSH_EXPLICIT_BIT);
+	}
+
+	stream->head = offset + size;
+
+	return result;
+}
+
+void stream_buffer_commit(StreamBuffer *stream, StreamAllocation *allocation, size_t used)
+{
+	ASSERT(used <= allocation->size, "Committed %zu bytes of a %zu byte stream allocation.", used, allocation->size);
+
+	if (!stream->persistent) {
+		GL_CALL(glBindBuffer, GL_ARRAY_BUFFER, stream->buffer);
+		if (used) {
+			GL_CALL(glFlushMappedBufferRange, GL_ARRAY_BUFFER, 0, used);
+		}
+		GL_CALL(glUnmapBuffer, GL_ARRAY_BUFFER);
+	}
+
+	// Give back the reserved but unused tail, as long as nothing was allocated after it
+	if (stream->head == allocation->offset + allocation->size) {
+		stream->head = allocation->offset + used;
+	}
+	allocation->size = used;
+	allocation->ptr = NULL;
+}
+
+void stream_buffer_bind_range(StreamBuffer *stream, GLenum target, u32 index, const StreamAllocation *allocation)
+{
+	GL_CALL(glBindBufferRange, target, index, stream->buffer, allocation->offset, allocation->size);
+}
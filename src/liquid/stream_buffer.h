@@ -0,0 +1,57 @@
+#pragma once
+
+#include "common.h"
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include <stddef.h>
+
+#define STREAM_BUFFER_FRAMES_IN_FLIGHT 3
+#define STREAM_BUFFER_DEFAULT_SIZE (3 * 8 * 1024 * 1024)
+
+typedef struct
+{
+	void *ptr;
+	size_t offset;
+	size_t size;
+} StreamAllocation;
+
+// Ring allocator for per-frame GPU data (vertices, instances, uniforms).
+//
+// With GL_ARB_buffer_storage the buffer is mapped once, persistently and
+// coherently, and split into one region per frame in flight. A fence is placed
+// at the end of each frame, and a region is only reused after its fence has
+// signaled, so writes go straight into GPU-visible memory without driver copies.
+// Without the extension the buffer is orphaned whenever it fills up and ranges
+// are mapped unsynchronized one allocation at a time.
+//
+// Usage: stream_buffer_alloc, write to ptr, stream_buffer_commit with the number
+// of bytes actually written, then draw from offset. Only one allocation may be
+// open at a time.
+typedef struct
+{
+	GLuint buffer;
+	size_t size;
+	bool persistent;
+	u8 *mapped;
+
+	size_t head;
+	size_t region_start;
+	size_t region_end;
+	u32 frame;
+	GLsync fences[STREAM_BUFFER_FRAMES_IN_FLIGHT];
+
+	u32 stalls;
+} StreamBuffer;
+
+void stream_buffer_init(StreamBuffer *stream, size_t size);
+void stream_buffer_destroy(StreamBuffer *stream);
+
+void stream_buffer_begin_frame(StreamBuffer *stream);
+void stream_buffer_end_frame(StreamBuffer *stream);
+
+StreamAllocation stream_buffer_alloc(StreamBuffer *stream, size_t size, size_t alignment);
+void stream_buffer_commit(StreamBuffer *stream, StreamAllocation *allocation, size_t used);
+
+void stream_buffer_bind_range(StreamBuffer *stream, GLenum target, u32 index, const StreamAllocation *allocation);
@@ -1,4 +1,6 @@
 #include "texture.h"
+#include "gl_state.h"
+#include "resource_registry.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb/stb_image.h"
@@ -13,7 +15,7 @@ Texture texture_load(const char *path)
 	}
 
 	GL_CALL(glGenTextures, 1, &result.id);
-	GL_CALL(glBindTexture, GL_TEXTURE_2D, result.id);
+	gl_state_bind_texture(0, result.id);
 	
 	GL_CALL(glTexImage2D, GL_TEXTURE_2D, 0, GL_RGB, result.width, result.height, 0, GL_RGB, GL_UNSIGNED_BYTE, result.data);
 
@@ -23,6 +25,7 @@ Texture texture_load(const char *path)
 	GL_CALL(glTexParameteri, GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 	GL_CALL(glTexParameteri, GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 
+	resource_registry_add(RESOURCE_TEXTURE, result.id, path, 0.0f);
 	INFO("Loaded texture: %s", path);
 
 	return result;
@@ -35,7 +38,7 @@ void texture_init(Texture *texture, i32 width, i32 height, GLenum format, GLenum
 	texture->height = height;
 
 	GL_CALL(glGenTextures, 1, &texture->id);
-	GL_CALL(glBindTexture, GL_TEXTURE_2D, texture->id);
+	gl_state_bind_texture(0, texture->id);
 	
 	GL_CALL(glTexImage2D, GL_TEXTURE_2D, 0, format, texture->width, texture->height, 0, format, type, image);
 
@@ -48,6 +51,8 @@ void texture_init(Texture *texture, i32 width, i32 height, GLenum format, GLenum
 
 void texture_destroy(Texture *texture)
 {
+	resource_registry_remove(RESOURCE_TEXTURE, texture->id);
+	gl_state_forget_texture(texture->id);
 	GL_CALL(glDeleteTextures, 1, &texture->id);
 	stbi_image_free(texture->data);
 	texture->data = NULL;
@@ -58,6 +63,5 @@ void texture_destroy(Texture *texture)
 
 void texture_bind(const Texture *texture)
 {
-	GL_CALL(glActiveTexture, GL_TEXTURE0);
-	GL_CALL(glBindTexture, GL_TEXTURE_2D, texture->id);
+	gl_state_bind_texture(0, texture->id);
 }
\ No newline at end of file
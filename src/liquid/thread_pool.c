@@ -0,0 +1,135 @@
+#include "thread_pool.h"
+
+#include <unistd.h>
+
+static void run_batches(ThreadPool *pool, ThreadPoolFunc func, void *user_data, u32 count, u32 batch_size)
+{
+	for (;;) {
+		u32 begin = __atomic_fetch_add(&pool->next, batch_size, __ATOMIC_RELAXED);
+		if (begin >= count) {
+			break;
+		}
+		u32 end = begin + batch_size < count ? begin + batch_size : count;
+		func(user_data, begin, end);
+	}
+}
+
+static void *worker_main(void *arg)
+{
+	ThreadPool *pool = arg;
+	u64 seen_generation = 0;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		while (!pool->quit && pool->generation == seen_generation) {
+			pthread_cond_wait(&pool->work_available, &pool->mutex);
+		}
+		if (pool->quit) {
+			break;
+		}
+
+		// Joining under the lock means a new job is not published while this worker
+		// still holds on to the old one
+		seen_generation = pool->generation;
+		ThreadPoolFunc func = pool->func;
+		void *user_data = pool->user_data;
+		u32 count = pool->count;
+		u32 batch_size = pool->batch_size;
+		pool->active_workers++;
+		pthread_mutex_unlock(&pool->mutex);
+
+		run_batches(pool, func, user_data, count, batch_size);
+
+		pthread_mutex_lock(&pool->mutex);
+		if (--pool->active_workers == 0) {
+			pthread_cond_signal(&pool->work_done);
+		}
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+u32 thread_pool_hardware_threads()
+{
+	long result = sysconf(_SC_NPROCESSORS_ONLN);
+	return result > 0 ? (u32) result : 1;
+}
+
+void thread_pool_init(ThreadPool *pool, u32 num_threads)
+{
+	if (num_threads == 0) {
+		num_threads = thread_pool_hardware_threads() - 1;
+	}
+	if (num_threads > THREAD_POOL_MAX_THREADS) {
+		num_threads = THREAD_POOL_MAX_THREADS;
+	}
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->work_available, NULL);
+	pthread_cond_init(&pool->work_done, NULL);
+	pool->generation = 0;
+	pool->active_workers = 0;
+	pool->quit = false;
+	pool->num_threads = 0;
+
+	for (u32 i = 0; i < num_threads; i++) {
+		if (pthread_create(&pool->threads[i], NULL, worker_main, pool) != 0) {
+			WARN("Could only start %d of %d worker threads.", i, num_threads);
+			break;
+		}
+		pool->num_threads++;
+	}
+}
+
+void thread_pool_destroy(ThreadPool *pool)
+{
+	pthread_mutex_lock(&pool->mutex);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->work_available);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (u32 i = 0; i < pool->num_threads; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+	pool->num_threads = 0;
+
+	pthread_cond_destroy(&pool->work_done);
+	pthread_cond_destroy(&pool->work_available);
+	pthread_mutex_destroy(&pool->mutex);
+}
+
+void thread_pool_parallel_for(ThreadPool *pool, u32 count, u32 batch_size, ThreadPoolFunc func, void *user_data)
+{
+	if (batch_size == 0) {
+		batch_size = 1;
+	}
+
+	if (pool == NULL || pool->num_threads == 0 || count <= batch_size) {
+		if (count > 0) {
+			func(user_data, 0, count);
+		}
+		return;
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	while (pool->active_workers > 0) {
+		pthread_cond_wait(&pool->work_done, &pool->mutex);
+	}
+	pool->func = func;
+	pool->user_data = user_data;
+	pool->count = count;
+	pool->batch_size = batch_size;
+	pool->next = 0;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->work_available);
+	pthread_mutex_unlock(&pool->mutex);
+
+	run_batches(pool, func, user_data, count, batch_size);
+
+	pthread_mutex_lock(&pool->mutex);
+	while (pool->active_workers > 0) {
+		pthread_cond_wait(&pool->work_done, &pool->mutex);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "common.h"
+
+#include <pthread.h>
+
+#define THREAD_POOL_MAX_THREADS 64
+
+// Processes the items [begin, end) of a parallel_for
+typedef void (*ThreadPoolFunc)(void *user_data, u32 begin, u32 end);
+
+// Fixed set of worker threads that split parallel_for ranges into batches. The
+// calling thread works on batches too and returns once every item is done.
+typedef struct
+{
+	pthread_t threads[THREAD_POOL_MAX_THREADS];
+	u32 num_threads;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t work_available;
+	pthread_cond_t work_done;
+	u64 generation;
+	u32 active_workers;
+	bool quit;
+
+	ThreadPoolFunc func;
+	void *user_data;
+	u32 count;
+	u32 batch_size;
+	u32 next;
+} ThreadPool;
+
+u32 thread_pool_hardware_threads();
+
+// Starts num_threads workers; zero means one less than the number of hardware threads
+void thread_pool_init(ThreadPool *pool, u32 num_threads);
+void thread_pool_destroy(ThreadPool *pool);
+void thread_pool_parallel_for(ThreadPool *pool, u32 count, u32 batch_size, ThreadPoolFunc func, void *user_data);
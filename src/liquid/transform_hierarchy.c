@@ -0,0 +1,173 @@
+#include "transform_hierarchy.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+	TransformHierarchy *hierarchy;
+	u32 first;
+} UpdateRange;
+
+void transform_hierarchy_init(TransformHierarchy *hierarchy)
+{
+	TransformHierarchy empty = {};
+	*hierarchy = empty;
+}
+
+void transform_hierarchy_destroy(TransformHierarchy *hierarchy)
+{
+	free(hierarchy->locals);
+	free(hierarchy->worlds);
+	free(hierarchy->parents);
+	free(hierarchy->levels);
+	free(hierarchy->nodes);
+	free(hierarchy->positions);
+	free(hierarchy->level_starts);
+	transform_hierarchy_init(hierarchy);
+}
+
+// New nodes are appended; transform_hierarchy_update moves them into level order
+TransformNode transform_hierarchy_add(TransformHierarchy *hierarchy, TransformNode parent, Transform local)
+{
+	if (hierarchy->count == hierarchy->capacity) {
+		u32 capacity = hierarchy->capacity ? 2 * hierarchy->capacity : 256;
+		hierarchy->locals = realloc(hierarchy->locals, capacity * sizeof(Transform));
+		hierarchy->worlds = realloc(hierarchy->worlds, capacity * sizeof(mat4));
+		hierarchy->parents = realloc(hierarchy->parents, capacity * sizeof(u32));
+		hierarchy->levels = realloc(hierarchy->levels, capacity * sizeof(u32));
+		hierarchy->nodes = realloc(hierarchy->nodes, capacity * sizeof(TransformNode));
+		hierarchy->positions = realloc(hierarchy->positions, capacity * sizeof(u32));
+		hierarchy->capacity = capacity;
+	}
+
+	u32 position = hierarchy->count++;
+	TransformNode result = position;
+
+	u32 parent_position = parent == TRANSFORM_NODE_NONE ? TRANSFORM_NODE_NONE : hierarchy->positions[parent];
+	hierarchy->locals[position] = local;
+	hierarchy->worlds[position] = mat4_identity();
+	hierarchy->parents[position] = parent_position;
+	hierarchy->levels[position] = parent == TRANSFORM_NODE_NONE ? 0 : hierarchy->levels[parent_position] + 1;
+	hierarchy->nodes[position] = result;
+	hierarchy->positions[result] = position;
+
+	hierarchy->dirty = true;
+
+	return result;
+}
+
+Transform *transform_hierarchy_local(TransformHierarchy *hierarchy, TransformNode node)
+{
+	return &hierarchy->locals[hierarchy->positions[node]];
+}
+
+const mat4 *transform_hierarchy_world(const TransformHierarchy *hierarchy, TransformNode node)
+{
+	return &hierarchy->worlds[hierarchy->positions[node]];
+}
+
+// Counting sort by level. It is stable, so siblings keep the order they were added in.
+static void sort_by_level(TransformHierarchy *hierarchy)
+{
+	u32 count = hierarchy->count;
+
+	u32 num_levels = 0;
+	for (u32 i = 0; i < count; i++) {
+		if (hierarchy->levels[i] + 1 > num_levels) {
+			num_levels = hierarchy->levels[i] + 1;
+		}
+	}
+
+	if (num_levels + 1 > hierarchy->levels_capacity) {
+		hierarchy->levels_capacity = num_levels + 1;
+		hierarchy->level_starts = realloc(hierarchy->level_starts, hierarchy->levels_capacity * sizeof(u32));
+	}
+	u32 *starts = hierarchy->level_starts;
+	memset(starts, 0, (num_levels + 1) * sizeof(u32));
+	for (u32 i = 0; i < count; i++) {
+		starts[hierarchy->levels[i] + 1]++;
+	}
+	for (u32 i = 0; i < num_levels; i++) {
+		starts[i + 1] += starts[i];
+	}
+
+	Transform *locals = malloc(count * sizeof(Transform));
+	u32 *parents = malloc(count * sizeof(u32));
+	u32 *levels = malloc(count * sizeof(u32));
+	TransformNode *nodes = malloc(count * sizeof(TransformNode));
+	u32 *new_positions = malloc(count * sizeof(u32));
+
+	u32 *cursor = malloc(num_levels * sizeof(u32));
+	memcpy(cursor, starts, num_levels * sizeof(u32));
+	for (u32 i = 0; i < count; i++) {
+		new_positions[i] = cursor[hierarchy->levels[i]]++;
+	}
+	free(cursor);
+
+	for (u32 i = 0; i < count; i++) {
+		u32 p = new_positions[i];
+		u32 parent = hierarchy->parents[i];
+		locals[p] = hierarchy->locals[i];
+		parents[p] = parent == TRANSFORM_NODE_NONE ? TRANSFORM_NODE_NONE : new_positions[parent];
+		levels[p] = hierarchy->levels[i];
+		nodes[p] = hierarchy->nodes[i];
+		hierarchy->positions[nodes[p]] = p;
+	}
+	free(new_positions);
+
+	memcpy(hierarchy->locals, locals, count * sizeof(Transform));
+	memcpy(hierarchy->parents, parents, count * sizeof(u32));
+	memcpy(hierarchy->levels, levels, count * sizeof(u32));
+	memcpy(hierarchy->nodes, nodes, count * sizeof(TransformNode));
+	free(locals);
+	free(parents);
+	free(levels);
+	free(nodes);
+
+	hierarchy->num_levels = num_levels;
+	hierarchy->dirty = false;
+}
+
+// mat4_mul(a, b) applies a first, so the local transformation goes on the left
+static void update_worlds(void *user_data, u32 begin, u32 end)
+{
+	UpdateRange *range = user_data;
+	TransformHierarchy *hierarchy = range->hierarchy;
+	const Transform *locals = hierarchy->locals;
+	const u32 *parents = hierarchy->parents;
+	mat4 *worlds = hierarchy->worlds;
+
+	for (u32 i = range->first + begin; i < range->first + end; i++) {
+		mat4 local = mat4_transformation(&locals[i]);
+		u32 parent = parents[i];
+		worlds[i] = parent == TRANSFORM_NODE_NONE ? local : mat4_mul(local, worlds[parent]);
+	}
+}
+
+void transform_hierarchy_update(TransformHierarchy *hierarchy, ThreadPool *pool)
+{
+	if (hierarchy->dirty) {
+		sort_by_level(hierarchy);
+	}
+
+	// Small trees are done in one pass, since each level only reads earlier ones
+	bool parallel = pool != NULL && pool->num_threads > 0;
+	if (!parallel || hierarchy->count < TRANSFORM_HIERARCHY_PARALLEL_THRESHOLD) {
+		UpdateRange range = {hierarchy, 0};
+		update_worlds(&range, 0, hierarchy->count);
+		return;
+	}
+
+	for (u32 level = 0; level < hierarchy->num_levels; level++) {
+		u32 first = hierarchy->level_starts[level];
+		u32 count = hierarchy->level_starts[level + 1] - first;
+		UpdateRange range = {hierarchy, first};
+
+		if (count < TRANSFORM_HIERARCHY_PARALLEL_THRESHOLD) {
+			update_worlds(&range, 0, count);
+		} else {
+			thread_pool_parallel_for(pool, count, TRANSFORM_HIERARCHY_BATCH_SIZE, update_worlds, &range);
+		}
+	}
+}
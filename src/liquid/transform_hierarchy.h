@@ -0,0 +1,51 @@
+#pragma once
+
+#include "common.h"
+#include "maths.h"
+#include "thread_pool.h"
+
+#define TRANSFORM_NODE_NONE 0xffffffff
+
+// Levels with fewer nodes than this are updated on the calling thread
+#define TRANSFORM_HIERARCHY_PARALLEL_THRESHOLD 4096
+#define TRANSFORM_HIERARCHY_BATCH_SIZE 1024
+
+// Stable handle to a node; its position in the arrays changes when nodes are added
+typedef u32 TransformNode;
+
+// Transform tree stored as parallel arrays, sorted by depth. Every parent comes
+// before its children, so all world matrices are computed in one front-to-back
+// pass, and the nodes of one level only depend on earlier levels, which lets
+// large levels be split between threads.
+typedef struct
+{
+	u32 count;
+	u32 capacity;
+
+	// Indexed by position, in level order
+	Transform *locals;
+	mat4 *worlds;
+	u32 *parents; // Position of the parent, TRANSFORM_NODE_NONE for roots
+	u32 *levels;
+	TransformNode *nodes;
+
+	// Indexed by node
+	u32 *positions;
+
+	u32 *level_starts; // num_levels + 1 entries
+	u32 num_levels;
+	u32 levels_capacity;
+
+	// Set when nodes were added, which requires re-sorting before the next update
+	bool dirty;
+} TransformHierarchy;
+
+void transform_hierarchy_init(TransformHierarchy *hierarchy);
+void transform_hierarchy_destroy(TransformHierarchy *hierarchy);
+
+TransformNode transform_hierarchy_add(TransformHierarchy *hierarchy, TransformNode parent, Transform local);
+Transform *transform_hierarchy_local(TransformHierarchy *hierarchy, TransformNode node);
+const mat4 *transform_hierarchy_world(const TransformHierarchy *hierarchy, TransformNode node);
+
+// Recomputes all world matrices; pool may be NULL to stay on the calling thread
+void transform_hierarchy_update(TransformHierarchy *hierarchy, ThreadPool *pool);
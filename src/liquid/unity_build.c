@@ -1,8 +1,23 @@
 #include "common.h"
 
+#include "arena.c"
+#include "cpu_profiler.c"
 #include "maths.c"
+#include "thread_pool.c"
+#include "transform_hierarchy.c"
+#include "resource_registry.c"
+#include "gl_state.c"
 #include "graphics.c"
 #include "shader.c"
 #include "texture.c"
+#include "stream_buffer.c"
+#include "gpu_profiler.c"
+#include "frame_capture.c"
+#include "frame_pacer.c"
+#include "headless.c"
+#include "sprite_batch.c"
+#include "mesh_buffer.c"
+#include "culling.c"
 #include "obj_loading.c"
+#include "command_capture.c"
 #include "input.c"
\ No newline at end of file
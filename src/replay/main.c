@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "graphics.h"
+#include "command_capture.h"
+#include "cpu_profiler.h"
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+static int compare_f64(const void *a, const void *b)
+{
+	f64 x = *(const f64 *) a;
+	f64 y = *(const f64 *) b;
+	return (x > y) - (x < y);
+}
+
+static f64 percentile(const f64 *sorted, u32 count, f64 p)
+{
+	u32 rank = (u32) (p * count + 0.999999);
+	return sorted[(rank > 0 ? rank : 1) - 1];
+}
+
+int main(int argc, char const *argv[])
+{
+	const char *capture_path = NULL;
+	u32 loops = 3;
+	bool headless = false;
+	u32 width = 1280;
+	u32 height = 720;
+
+	for (i32 i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--loops") == 0 && i + 1 < argc) {
+			loops = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--size") == 0 && i + 2 < argc) {
+			width = atoi(argv[++i]);
+			height = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--headless") == 0) {
+			headless = true;
+		} else if (argv[i][0] != '-' && !capture_path) {
+			capture_path = argv[i];
+		} else {
+			capture_path = NULL;
+			break;
+		}
+	}
+	if (!capture_path || loops < 1) {
+		printf("Usage: %s capture.lqcs [--loops N] [--size width height] [--headless]\n", argv[0]);
+		return 1;
+	}
+
+	static GraphicsData graphics_data;
+	Window window;
+	if (headless) {
+#ifdef GRAPHICS_HEADLESS
+		window = graphics_create_headless(&graphics_data, width, height);
+#else
+		ERROR("Built without GRAPHICS_HEADLESS.");
+		return 1;
+#endif
+	} else {
+		window = graphics_create_window(&graphics_data, width, height, "Replay");
+		glfwSwapInterval(0);
+	}
+	if (window == -1) {
+		return 1;
+	}
+
+	CommandReplay replay;
+	if (!command_replay_open(&replay, capture_path)) {
+		graphics_destroy_window(&graphics_data, &window);
+		return 1;
+	}
+
+	// The first loop loads the resources and is not timed
+	u32 capacity = 1024;
+	f64 *frame_times = malloc(capacity * sizeof(f64));
+	for (u32 loop = 0; loop < loops; loop++) {
+		u32 num_frames = 0;
+		u64 total_begin = cpu_profiler_now();
+		u64 begin = total_begin;
+		while (command_replay_frame(&replay, &graphics_data, &window)) {
+			if (window == -1) {
+				break;
+			}
+
+			// Without a swap interval the GPU could fall behind; finishing keeps frames comparable
+			glFinish();
+			u64 now = cpu_profiler_now();
+			if (num_frames == capacity) {
+				capacity *= 2;
+				frame_times = realloc(frame_times, capacity * sizeof(f64));
+			}
+			frame_times[num_frames++] = (f64) (now - begin) / 1000000.0;
+			begin = now;
+		}
+		f64 total_ms = (f64) (cpu_profiler_now() - total_begin) / 1000000.0;
+		command_replay_rewind(&replay);
+
+		if (window == -1) {
+			break;
+		}
+		if (num_frames == 0) {
+			ERROR("%s contains no frames.", capture_path);
+			break;
+		}
+		if (loop == 0 && loops > 1) {
+			INFO("Warm-up: %u frames in %.1f ms, %u commands skipped.", num_frames, total_ms, replay.skipped_commands);
+			continue;
+		}
+
+		qsort(frame_times, num_frames, sizeof(f64), compare_f64);
+		printf("loop %u: %u frames in %.1f ms (%.1f fps)  p50 %.3f ms  p99 %.3f ms  max %.3f ms\n",
+			loop, num_frames, total_ms, 1000.0 * num_frames / total_ms,
+			percentile(frame_times, num_frames, 0.5), percentile(frame_times, num_frames, 0.99), frame_times[num_frames - 1]);
+	}
+	free(frame_times);
+
+	command_replay_close(&replay);
+	if (window != -1) {
+		graphics_destroy_window(&graphics_data, &window);
+	}
+	return 0;
+}
@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
 
 #include "common.h"
 #include "maths.h"
@@ -8,12 +10,22 @@
 #include "obj_loading.h"
 #include "input.h"
 #include "liquid.h"
+#include "cpu_profiler.h"
+#include "stress_scene.h"
+#include "command_capture.h"
+#include "frame_pacer.h"
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>	
 
 ControlData control;
 
+enum
+{
+	LAYER_WORLD,
+	LAYER_UI
+};
+
 int main(int argc, char const *argv[])
 {
 
@@ -24,6 +36,11 @@ int main(int argc, char const *argv[])
 
 	input_initialize(&control.input_data, &control.graphics_data, window);
 
+	LayerConfig world_layer = {LAYER_SORT_FRONT_TO_BACK, true, true, false};
+	LayerConfig ui_layer = {LAYER_SORT_SUBMISSION, false, false, true};
+	graphics_set_layer(&control.graphics_data, LAYER_WORLD, &world_layer);
+	graphics_set_layer(&control.graphics_data, LAYER_UI, &ui_layer);
+
 	Mesh bunny = obj_load_mesh("res/sandbox/bunny.obj");
 	Mesh monkey = obj_load_mesh("res/sandbox/monkey.obj");
 	Mesh dragon = obj_load_mesh("res/sandbox/dragon.obj");
@@ -51,16 +68,60 @@ int main(int argc, char const *argv[])
 
 	Font font = font_load("res/sandbox/CourierNew.ttf", 32.0f);
 
+	StressScene stress_scene;
+	StressSceneParams stress_params;
+	bool stress = stress_scene_parse_args(&stress_params, argc, argv);
+	if (stress) {
+		Mesh library[] = {bunny, monkey, dragon};
+		stress_scene_init(&stress_scene, &stress_params, library, sizeof(library) / sizeof(Mesh), font);
+	}
+
+	// Everything that touches GL directly is loaded by now
+	const char *cpu_trace_path = NULL;
+	const char *capture_prefix = NULL;
+	f64 target_fps = 0.0;
+	bool late_input = false;
+	for (i32 i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--render-thread") == 0) {
+			graphics_start_render_thread(&control.graphics_data, window);
+		} else if (strcmp(argv[i], "--gpu-profile") == 0 && i + 1 < argc) {
+			gpu_profiler_open_csv(&graphics_get_window(&control.graphics_data, window)->gpu_profiler, argv[++i]);
+		} else if (strcmp(argv[i], "--cpu-trace") == 0 && i + 1 < argc) {
+			cpu_trace_path = argv[++i];
+		} else if (strcmp(argv[i], "--capture-commands") == 0 && i + 1 < argc) {
+			command_capture_begin(&control.graphics_data, argv[++i]);
+		} else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+			capture_prefix = argv[++i];
+		} else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+			target_fps = atof(argv[++i]);
+		} else if (strcmp(argv[i], "--late-input") == 0) {
+			late_input = true;
+		} else if (strcmp(argv[i], "--idle") == 0) {
+			graphics_set_idle_skipping(&control.graphics_data, true, 0.5);
+		}
+	}
+
+	if (stress) {
+		stress_scene_run(&stress_scene, &control.graphics_data, window, width, height);
+		if (cpu_trace_path) {
+			cpu_profiler_export_chrome_trace(cpu_trace_path);
+		}
+		return 0;
+	}
+
 	bool mouse_control = false;
 	f32 turn_speed = 0.005f;
 	vec2 angles = vec2_zero();
 
+	FramePacer pacer;
+	frame_pacer_init(&pacer, target_fps, late_input);
+
+	u32 frame = 0;
 	f32 t = 0;
 	while (!graphics_terminated(&control.graphics_data))
 	{
 		t += 0.01f;
 
-		input_update(&control.input_data, window);
 		graphics_begin_frame(&control.graphics_data, &window);
 
 		vec4 color1 = {0, 0.1, 0.1, 1};
@@ -77,6 +138,20 @@ int main(int argc, char const *argv[])
 		t4.rot = t3.rot;
 		t5.rot = t3.rot;
 
+		DrawTextCommandData texts[] = {
+			{"Hello, World.", t2, ortho, font},
+			{"It is I, Leonard.", t6, ortho, font}
+		};
+		for (u32 i = 0; i < sizeof(texts) / sizeof(DrawTextCommandData); i++) {
+			DrawCommand cmd = {DRAW_TEXT, LAYER_UI, 0, &texts[i]};
+			graphics_submit_call(&control.graphics_data, &cmd);
+		}
+
+		// Everything that does not depend on input is done by now, so the pacer can
+		// hold the input sampling back until just before the rest is submitted
+		frame_pacer_wait(&pacer);
+		input_update(&control.input_data, window);
+
 		float speed = 0.1f;
 		vec2 move_amount = vec2_zero();
 		if (input_get_key(&control.input_data, KEY_W))
@@ -122,15 +197,37 @@ int main(int argc, char const *argv[])
 			camera.transform.rot = quat_normalize(quat_mul(rot1, rot2));
 		}
 
-		graphics_draw_mesh(&control.graphics_data, dragon, &t5, camera_view_projection(&camera), &bricks, color1);
-		graphics_draw_mesh(&control.graphics_data, bunny, &t3, camera_view_projection(&camera), &bricks, color1);
-		graphics_draw_mesh(&control.graphics_data, monkey, &t4, camera_view_projection(&camera), &bricks, color1);
-		graphics_draw_text(&control.graphics_data, "Hello, World.", font, &t2, ortho);
-		graphics_draw_text(&control.graphics_data, "It is I, Leonard.", font, &t6, ortho);
+		mat4 view_projection = camera_view_projection(&camera);
+
+		DrawMeshCommandData meshes[] = {
+			{dragon, t5, view_projection, bricks, color1},
+			{bunny, t3, view_projection, bricks, color1},
+			{monkey, t4, view_projection, bricks, color1}
+		};
+		for (u32 i = 0; i < sizeof(meshes) / sizeof(DrawMeshCommandData); i++) {
+			DrawCommand cmd = {DRAW_MESH, LAYER_WORLD, 0, &meshes[i]};
+			graphics_submit_call(&control.graphics_data, &cmd);
+		}
 
 		graphics_sort_and_flush_queue(&control.graphics_data);
 
+		if (capture_prefix) {
+			char path[256];
+			snprintf(path, sizeof(path), "%s%05u.png", capture_prefix, frame);
+			graphics_capture_frame_async(&control.graphics_data, path, FRAME_CAPTURE_PNG);
+		}
+		frame++;
+
 		graphics_end_frame(&control.graphics_data, &window);
+		frame_pacer_end_frame(&pacer);
+	}
+
+	FramePacerStats pacing = frame_pacer_stats(&pacer);
+	INFO("Frame pacing over %u frames: mean %.3f ms, jitter %.3f ms, max deviation %.3f ms, work %.3f ms",
+		 pacing.num_frames, pacing.mean_interval, pacing.jitter, pacing.max_deviation, pacing.work_estimate);
+
+	if (cpu_trace_path) {
+		cpu_profiler_export_chrome_trace(cpu_trace_path);
 	}
 
 	return 0;
@@ -0,0 +1,284 @@
+#include "stress_scene.h"
+#include "cpu_profiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STRESS_TEXTURE_SIZE 64
+
+// Small LCG, so that a seed gives the same scene on every platform
+static u32 random_next(u32 *state)
+{
+	*state = *state * 1664525u + 1013904223u;
+	return *state >> 8;
+}
+
+static f32 random_range(u32 *state, f32 min, f32 max)
+{
+	return min + (max - min) * (f32) random_next(state) / (f32) (1 << 24);
+}
+
+static vec4 random_color(u32 *state)
+{
+	return vec4_new(random_range(state, 0.2f, 1.0f), random_range(state, 0.2f, 1.0f), random_range(state, 0.2f, 1.0f), 1.0f);
+}
+
+bool stress_scene_parse_args(StressSceneParams *params, i32 argc, char const *argv[])
+{
+	params->meshes = 1000;
+	params->labels = 100;
+	params->rects = 1000;
+	params->depth = 3;
+	params->textures = 4;
+	params->seed = 1;
+	params->frames = 1000;
+
+	bool result = false;
+	for (i32 i = 1; i < argc; i++) {
+		u32 *value = NULL;
+		if (strcmp(argv[i], "--stress") == 0) {
+			result = true;
+		} else if (strcmp(argv[i], "--meshes") == 0) {
+			value = &params->meshes;
+		} else if (strcmp(argv[i], "--labels") == 0) {
+			value = &params->labels;
+		} else if (strcmp(argv[i], "--rects") == 0) {
+			value = &params->rects;
+		} else if (strcmp(argv[i], "--depth") == 0) {
+			value = &params->depth;
+		} else if (strcmp(argv[i], "--textures") == 0) {
+			value = &params->textures;
+		} else if (strcmp(argv[i], "--seed") == 0) {
+			value = &params->seed;
+		} else if (strcmp(argv[i], "--frames") == 0) {
+			value = &params->frames;
+		}
+
+		if (value && i + 1 < argc) {
+			*value = (u32) strtoul(argv[++i], NULL, 10);
+		}
+	}
+
+	if (params->textures == 0) {
+		params->textures = 1;
+	}
+	return result;
+}
+
+// Checkerboard in two random colors, so that the textures differ in content too
+static Texture create_texture(u32 *state)
+{
+	vec4 a = random_color(state);
+	vec4 b = random_color(state);
+
+	u8 *pixels = malloc(STRESS_TEXTURE_SIZE * STRESS_TEXTURE_SIZE * 3);
+	for (u32 y = 0; y < STRESS_TEXTURE_SIZE; y++) {
+		for (u32 x = 0; x < STRESS_TEXTURE_SIZE; x++) {
+			vec4 c = ((x / 8) + (y / 8)) % 2 ? a : b;
+			u8 *pixel = &pixels[3 * (y * STRESS_TEXTURE_SIZE + x)];
+			pixel[0] = (u8) (255.0f * c.x);
+			pixel[1] = (u8) (255.0f * c.y);
+			pixel[2] = (u8) (255.0f * c.z);
+		}
+	}
+
+	Texture result = {};
+	result.comps_per_pixel = 3;
+	texture_init(&result, STRESS_TEXTURE_SIZE, STRESS_TEXTURE_SIZE, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+	return result;
+}
+
+void stress_scene_init(StressScene *scene, const StressSceneParams *params, const Mesh *meshes, u32 num_meshes, Font font)
+{
+	memset(scene, 0, sizeof(StressScene));
+	scene->params = *params;
+	scene->mesh_library = meshes;
+	scene->num_library_meshes = num_meshes;
+	scene->font = font;
+
+	u32 state = params->seed;
+
+	scene->textures = malloc(params->textures * sizeof(Texture));
+	for (u32 i = 0; i < params->textures; i++) {
+		scene->textures[i] = create_texture(&state);
+	}
+
+	// Chains of depth nodes spread in front of the camera; every mesh hangs off
+	// the deepest node of one chain, so a deeper hierarchy moves the same meshes
+	// through more levels of transformation.
+	transform_hierarchy_init(&scene->hierarchy);
+	for (u32 i = 0; i < STRESS_SCENE_GROUPS && params->depth > 0; i++) {
+		Transform root = {vec3_new(random_range(&state, -6, 6), random_range(&state, -4, 4), random_range(&state, -18, -8)), vec3_new(1, 1, 1), quat_null_rotation()};
+		TransformNode node = transform_hierarchy_add(&scene->hierarchy, TRANSFORM_NODE_NONE, root);
+		for (u32 level = 1; level < params->depth; level++) {
+			Transform local = {vec3_new(random_range(&state, -0.5f, 0.5f), random_range(&state, -0.5f, 0.5f), 0), vec3_new(1, 1, 1), quat_null_rotation()};
+			node = transform_hierarchy_add(&scene->hierarchy, node, local);
+		}
+		scene->leaf_nodes[i] = node;
+	}
+	thread_pool_init(&scene->pool, 0);
+
+	scene->meshes = malloc(params->meshes * sizeof(StressMesh));
+	for (u32 i = 0; i < params->meshes; i++) {
+		StressMesh *mesh = &scene->meshes[i];
+		f32 scale = random_range(&state, 0.1f, 0.4f);
+		vec3 pos = params->depth > 0
+			? vec3_new(random_range(&state, -2, 2), random_range(&state, -2, 2), random_range(&state, -2, 2))
+			: vec3_new(random_range(&state, -8, 8), random_range(&state, -5, 5), random_range(&state, -20, -6));
+		Transform local = {pos, vec3_new(scale, scale, scale), quat_from_axis_angle(vec3_new(0, 1, 0), random_range(&state, 0, 6.28f))};
+		mesh->local = local;
+		mesh->group = random_next(&state) % STRESS_SCENE_GROUPS;
+		mesh->mesh = num_meshes ? random_next(&state) % num_meshes : 0;
+		mesh->texture = random_next(&state) % params->textures;
+		mesh->color = random_color(&state);
+	}
+
+	scene->rects = malloc(params->rects * sizeof(StressRect));
+	for (u32 i = 0; i < params->rects; i++) {
+		StressRect *rect = &scene->rects[i];
+		f32 size = random_range(&state, 4, 24);
+		Transform transform = {vec3_new(random_range(&state, 0, 1), random_range(&state, 0, 1), 0), vec3_new(size, size, 1), quat_null_rotation()};
+		rect->transform = transform;
+		rect->texture = random_next(&state) % params->textures;
+		rect->color = random_color(&state);
+	}
+
+	scene->labels = malloc(params->labels * sizeof(StressLabel));
+	for (u32 i = 0; i < params->labels; i++) {
+		StressLabel *label = &scene->labels[i];
+		Transform transform = {vec3_new(random_range(&state, 0, 1), random_range(&state, 0, 1), 0), vec3_new(1, 1, 1), quat_null_rotation()};
+		label->transform = transform;
+		snprintf(label->text, sizeof(label->text), "Label %u", i);
+	}
+
+	INFO("Stress scene: %u meshes, %u labels, %u rects, depth %u, %u textures, seed %u",
+		params->meshes, params->labels, params->rects, params->depth, params->textures, params->seed);
+}
+
+void stress_scene_destroy(StressScene *scene)
+{
+	for (u32 i = 0; i < scene->params.textures; i++) {
+		texture_destroy(&scene->textures[i]);
+	}
+	free(scene->textures);
+	free(scene->meshes);
+	free(scene->rects);
+	free(scene->labels);
+	transform_hierarchy_destroy(&scene->hierarchy);
+	thread_pool_destroy(&scene->pool);
+}
+
+static void submit(StressScene *scene, GraphicsData *graphics_data, mat4 view_projection, mat4 ortho, u32 width, u32 height)
+{
+	PROFILE_FUNCTION();
+
+	if (scene->num_library_meshes > 0) {
+		for (u32 i = 0; i < scene->params.meshes; i++) {
+			const StressMesh *mesh = &scene->meshes[i];
+			// The chain's world matrix goes in as the parent, so every mesh
+			// shares the camera's view projection
+			DrawMeshCommandData data = {scene->mesh_library[mesh->mesh], mesh->local, view_projection, scene->textures[mesh->texture], mesh->color};
+			if (scene->params.depth > 0) {
+				data.has_parent = true;
+				data.parent = *transform_hierarchy_world(&scene->hierarchy, scene->leaf_nodes[mesh->group]);
+			}
+			DrawCommand cmd = {DRAW_MESH, 0, 0, &data};
+			graphics_submit_call(graphics_data, &cmd);
+		}
+	}
+
+	for (u32 i = 0; i < scene->params.rects; i++) {
+		const StressRect *rect = &scene->rects[i];
+		Transform transform = rect->transform;
+		transform.pos.x *= width;
+		transform.pos.y *= height;
+		DrawRectCommandData data = {transform, ortho, scene->textures[rect->texture], rect->color};
+		DrawCommand cmd = {DRAW_RECT, 0, 0, &data};
+		graphics_submit_call(graphics_data, &cmd);
+	}
+
+	for (u32 i = 0; i < scene->params.labels; i++) {
+		const StressLabel *label = &scene->labels[i];
+		Transform transform = label->transform;
+		transform.pos.x *= width;
+		transform.pos.y *= height;
+		DrawTextCommandData data = {label->text, transform, ortho, scene->font};
+		DrawCommand cmd = {DRAW_TEXT, 0, 0, &data};
+		graphics_submit_call(graphics_data, &cmd);
+	}
+}
+
+static int compare_f64(const void *a, const void *b)
+{
+	f64 x = *(const f64 *) a;
+	f64 y = *(const f64 *) b;
+	return (x > y) - (x < y);
+}
+
+static f64 percentile(const f64 *sorted, u32 count, f64 p)
+{
+	u32 rank = (u32) (p * count + 0.999999);
+	return sorted[(rank > 0 ? rank : 1) - 1];
+}
+
+void stress_scene_run(StressScene *scene, GraphicsData *graphics_data, Window window, u32 width, u32 height)
+{
+	mat4 ortho = mat4_ortho(0, width, height, 0, -1.0f, 100.0f);
+	Camera camera = {{vec3_zero(), vec3_new(1, 1, 1), quat_null_rotation()}, mat4_perspective(70.0f, (f32) width / height, 0.0f, 1000.0f)};
+	mat4 view_projection = camera_view_projection(&camera);
+	quat spin = quat_from_axis_angle(vec3_new(0, 1, 0), 0.01f);
+
+	u32 capacity = scene->params.frames ? scene->params.frames : 1024;
+	f64 *frame_times = malloc(capacity * sizeof(f64));
+	u32 num_frames = 0;
+	u64 draw_calls = 0;
+	u64 state_changes = 0;
+	u64 redundant_state_changes = 0;
+	u64 culled_meshes = 0;
+
+	u64 last = cpu_profiler_now();
+	while (!graphics_terminated(graphics_data) && (scene->params.frames == 0 || num_frames < scene->params.frames)) {
+		graphics_begin_frame(graphics_data, &window);
+
+		for (TransformNode node = 0; node < scene->hierarchy.count; node++) {
+			Transform *local = transform_hierarchy_local(&scene->hierarchy, node);
+			local->rot = quat_normalize(quat_mul(local->rot, spin));
+		}
+		transform_hierarchy_update(&scene->hierarchy, &scene->pool);
+
+		submit(scene, graphics_data, view_projection, ortho, width, height);
+		graphics_sort_and_flush_queue(graphics_data);
+		graphics_end_frame(graphics_data, &window);
+
+		u64 now = cpu_profiler_now();
+		if (num_frames == capacity) {
+			capacity *= 2;
+			frame_times = realloc(frame_times, capacity * sizeof(f64));
+		}
+		frame_times[num_frames++] = (f64) (now - last) / 1000000.0;
+		last = now;
+
+		if (window == -1) {
+			break;
+		}
+		FrameStats stats = graphics_frame_stats(graphics_data, window);
+		draw_calls += stats.draw_calls;
+		state_changes += stats.state_changes;
+		redundant_state_changes += stats.redundant_state_changes;
+		culled_meshes += stats.culled_meshes;
+	}
+
+	if (num_frames > 0) {
+		qsort(frame_times, num_frames, sizeof(f64), compare_f64);
+		printf("Stress scene: %u frames, %u meshes, %u labels, %u rects, depth %u, %u textures, seed %u\n",
+			num_frames, scene->params.meshes, scene->params.labels, scene->params.rects, scene->params.depth, scene->params.textures, scene->params.seed);
+		printf("  frame time ms: p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n",
+			percentile(frame_times, num_frames, 0.5), percentile(frame_times, num_frames, 0.9),
+			percentile(frame_times, num_frames, 0.99), frame_times[num_frames - 1]);
+		printf("  per frame: %.1f draw calls, %.1f state changes (%.1f redundant skipped), %.1f meshes culled\n",
+			(f64) draw_calls / num_frames, (f64) state_changes / num_frames,
+			(f64) redundant_state_changes / num_frames, (f64) culled_meshes / num_frames);
+	}
+	free(frame_times);
+}
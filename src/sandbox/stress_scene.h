@@ -0,0 +1,76 @@
+#pragma once
+
+#include "common.h"
+#include "maths.h"
+#include "graphics.h"
+#include "transform_hierarchy.h"
+#include "thread_pool.h"
+
+// Number of transform chains the mesh instances hang off; every level of the
+// hierarchy has one node per chain, so this many keeps each level at the
+// threshold where TransformHierarchy updates it on the thread pool
+#define STRESS_SCENE_GROUPS TRANSFORM_HIERARCHY_PARALLEL_THRESHOLD
+
+typedef struct
+{
+	u32 meshes;
+	u32 labels;
+	u32 rects;
+	u32 depth; // Levels of the transform hierarchy above each mesh, 0 for none
+	u32 textures;
+	u32 seed;
+	u32 frames; // 0 runs until the window is closed
+} StressSceneParams;
+
+typedef struct
+{
+	Transform local;
+	u32 group;
+	u32 mesh;
+	u32 texture;
+	vec4 color;
+} StressMesh;
+
+typedef struct
+{
+	Transform transform;
+	u32 texture;
+	vec4 color;
+} StressRect;
+
+typedef struct
+{
+	Transform transform;
+	char text[16];
+} StressLabel;
+
+// Randomly generated scene, identical for the same parameters and seed
+typedef struct
+{
+	StressSceneParams params;
+
+	const Mesh *mesh_library;
+	u32 num_library_meshes;
+	Font font;
+
+	Texture *textures;
+	StressMesh *meshes;
+	StressRect *rects;
+	StressLabel *labels;
+
+	TransformHierarchy hierarchy;
+	TransformNode leaf_nodes[STRESS_SCENE_GROUPS]; // Deepest node of every chain
+	ThreadPool pool;
+} StressScene;
+
+// Returns true when --stress is among the arguments; the other options are
+// --meshes, --labels, --rects, --depth, --textures, --seed and --frames.
+bool stress_scene_parse_args(StressSceneParams *params, i32 argc, char const *argv[]);
+
+// Creates the textures, so it has to run before a render thread is started
+void stress_scene_init(StressScene *scene, const StressSceneParams *params, const Mesh *meshes, u32 num_meshes, Font font);
+void stress_scene_destroy(StressScene *scene);
+
+// Draws the scene until params.frames have passed or the window closes, then
+// prints frame time percentiles and the average draw calls and state changes
+void stress_scene_run(StressScene *scene, GraphicsData *graphics_data, Window window, u32 width, u32 height);